@@ -0,0 +1,227 @@
+#include "batch.h"
+#include "cscript.h"
+#include "intern.h"
+#include "memory.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * batch mode compiles the script once and runs it for every input on
+ * a pool of worker threads. every worker owns a vm (stack, globals and
+ * heap) and all of them execute the same read-only chunk.
+ *
+ * the jobs are split into one contiguous range per worker, a worker
+ * takes jobs from the front of its own range and when that runs dry it
+ * steals the back half of somebody else's. a range is a head/tail pair
+ * packed into one 64-bit word so both sides can claim work with a
+ * single compare and swap.
+ */
+
+struct Worker
+{
+  _Atomic uint64_t range;
+  pthread_t thread;
+  int id;
+  int failed;
+  struct Batch *batch;
+};
+
+struct Batch
+{
+  struct BatchOptions *opts;
+  struct Script *script;
+  struct Worker *workers;
+  int worker_count;
+  double *latencies;
+};
+
+#define RANGE(head, tail) (((uint64_t)(tail) << 32) | (uint32_t)(head))
+#define RANGE_HEAD(range) ((uint32_t)(range))
+#define RANGE_TAIL(range) ((uint32_t)((range) >> 32))
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool pop_job(struct Worker *worker, int *job)
+{
+  uint64_t range = atomic_load(&worker->range);
+  while (RANGE_HEAD(range) < RANGE_TAIL(range))
+  {
+    uint64_t next = RANGE(RANGE_HEAD(range) + 1, RANGE_TAIL(range));
+    if (atomic_compare_exchange_weak(&worker->range, &range, next))
+    {
+      *job = RANGE_HEAD(range);
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool steal_jobs(struct Worker *thief)
+{
+  struct Batch *batch = thief->batch;
+  for (int i = 1; i < batch->worker_count; i++)
+  {
+    struct Worker *victim = &batch->workers[(thief->id + i) % batch->worker_count];
+    uint64_t range = atomic_load(&victim->range);
+    while (RANGE_HEAD(range) < RANGE_TAIL(range))
+    {
+      uint32_t head = RANGE_HEAD(range);
+      uint32_t tail = RANGE_TAIL(range);
+      uint32_t half = tail - (tail - head + 1) / 2;
+      if (atomic_compare_exchange_weak(&victim->range, &range, RANGE(head, half)))
+      {
+        /* our own range is empty so nobody else is touching it */
+        atomic_store(&thief->range, RANGE(half, tail));
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static char *read_input(const char *path)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+  fseek(file, 0L, SEEK_END);
+  size_t file_sz = ftell(file);
+  rewind(file);
+  char *buffer = (char *)malloc(file_sz + 1);
+  if (buffer != NULL)
+    buffer[fread(buffer, sizeof(char), file_sz, file)] = '\0';
+  fclose(file);
+  return buffer;
+}
+
+static bool run_job(struct Worker *worker, struct VM *vm, int job)
+{
+  struct BatchOptions *opts = worker->batch->opts;
+  char *input = opts->inputs_are_args ? opts->inputs[job] : read_input(opts->inputs[job]);
+  if (input == NULL)
+  {
+    fprintf(stderr, "Could not open file \"%s\".\n", opts->inputs[job]);
+    return false;
+  }
+
+  /* every run starts from an empty heap and fresh globals */
+  free_vm(vm);
+  init_vm(vm);
+  cs_attach(vm, worker->batch->script);
+  cs_set_global(vm, "input", cs_string(vm, input));
+  if (!opts->inputs_are_args)
+    free(input);
+
+  return cs_run(vm, worker->batch->script) == INTERPRET_OK;
+}
+
+static void *worker_main(void *arg)
+{
+  struct Worker *worker = (struct Worker *)arg;
+  struct VM vm;
+  init_vm(&vm);
+
+  int job;
+  for (;;)
+  {
+    if (!pop_job(worker, &job))
+    {
+      if (!steal_jobs(worker))
+        break;
+      continue;
+    }
+    double start = now_sec();
+    if (!run_job(worker, &vm, job))
+      worker->failed++;
+    worker->batch->latencies[job] = now_sec() - start;
+  }
+
+  free_vm(&vm);
+  return NULL;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+int run_batch(struct BatchOptions *opts)
+{
+  if (opts->shared_strings)
+    init_shared_strings(16);
+
+  struct VM vm;
+  init_vm(&vm);
+  struct Script *script = cs_compile(&vm, opts->src);
+  if (script == NULL)
+  {
+    free_vm(&vm);
+    free_shared_strings();
+    return 65;
+  }
+
+  int threads = opts->threads;
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > opts->input_count)
+    threads = opts->input_count > 0 ? opts->input_count : 1;
+
+  struct Batch batch;
+  batch.opts = opts;
+  batch.script = script;
+  batch.worker_count = threads;
+  batch.workers = (struct Worker *)reallocate(NULL, 0, sizeof(struct Worker) * threads);
+  batch.latencies = (double *)reallocate(NULL, 0, sizeof(double) * (opts->input_count + 1));
+
+  for (int i = 0; i < threads; i++)
+  {
+    struct Worker *worker = &batch.workers[i];
+    uint32_t head = (uint32_t)((int64_t)opts->input_count * i / threads);
+    uint32_t tail = (uint32_t)((int64_t)opts->input_count * (i + 1) / threads);
+    atomic_init(&worker->range, RANGE(head, tail));
+    worker->id = i;
+    worker->failed = 0;
+    worker->batch = &batch;
+  }
+
+  double start = now_sec();
+  for (int i = 0; i < threads; i++)
+    pthread_create(&batch.workers[i].thread, NULL, worker_main, &batch.workers[i]);
+  int failed = 0;
+  for (int i = 0; i < threads; i++)
+  {
+    pthread_join(batch.workers[i].thread, NULL);
+    failed += batch.workers[i].failed;
+  }
+  double elapsed = now_sec() - start;
+
+  qsort(batch.latencies, opts->input_count, sizeof(double), compare_latency);
+  double p50 = 0, p99 = 0;
+  if (opts->input_count > 0)
+  {
+    p50 = batch.latencies[(opts->input_count - 1) * 50 / 100];
+    p99 = batch.latencies[(opts->input_count - 1) * 99 / 100];
+  }
+  fprintf(stderr, "batch: %d runs on %d threads in %.3fs, %d failed\n",
+          opts->input_count, threads, elapsed, failed);
+  fprintf(stderr, "batch: %.1f runs/s, p50 %.1fus, p99 %.1fus\n",
+          elapsed > 0 ? opts->input_count / elapsed : 0.0, p50 * 1e6, p99 * 1e6);
+
+  reallocate(batch.latencies, sizeof(double) * (opts->input_count + 1), 0);
+  reallocate(batch.workers, sizeof(struct Worker) * threads, 0);
+  cs_free_script(script);
+  free_vm(&vm);
+  free_shared_strings();
+  return failed > 0 ? 70 : 0;
+}
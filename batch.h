@@ -0,0 +1,19 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "common.h"
+
+struct BatchOptions
+{
+  const char *src;
+  int threads;
+  /* either paths of input files or argument strings, one per run */
+  char **inputs;
+  int input_count;
+  bool inputs_are_args;
+  bool shared_strings;
+};
+
+int run_batch(struct BatchOptions *opts);
+
+#endif
@@ -0,0 +1,85 @@
+#include "cscript.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * measures compile throughput in lines per second on a generated
+ * script, 1M lines by default. the script has the shape of our
+ * generated rule files: many globals, blocks with locals, loops with
+ * break and continue, and an outer loop around the whole body so the
+ * jumps out of it are far longer than 16 bits.
+ */
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *generate(int lines)
+{
+  size_t capacity = (size_t)lines * 128 + 256;
+  char *src = (char *)malloc(capacity);
+  size_t length = 0;
+  int written = 0;
+
+#define LINE(...) (length += (size_t)sprintf(src + length, __VA_ARGS__), written++)
+  LINE("var done = false;\n");
+  LINE("while (!done) {\n");
+  for (int i = 0; written < lines - 2; i++)
+  {
+    switch (i % 4)
+    {
+      case 0:
+        LINE("  rule_%d = %d.5 * 2 + rule_count;\n", i / 4, i);
+        break;
+      case 1:
+        LINE("  { var limit = %d; var seen = \"rule %d\"; if (limit > 10) seen = seen + \"!\"; }\n", i, i);
+        break;
+      case 2:
+        LINE("  for (var k = 0; k < 3; k = k + 1) { if (k == 1) continue; if (k == %d) break; }\n", i % 3);
+        break;
+      case 3:
+        LINE("  if (rule_count == %d) { rule_count = rule_count + 1; } else { rule_count = 0; }\n", i);
+        break;
+    }
+  }
+  LINE("  done = true;\n");
+  LINE("}\n");
+#undef LINE
+  return src;
+}
+
+int main(int argc, char **argv)
+{
+  int lines = argc > 1 ? atoi(argv[1]) : 1000000;
+  int runs = argc > 2 ? atoi(argv[2]) : 3;
+  char *src = generate(lines);
+  printf("%d lines, %zu bytes of source\n", lines, strlen(src));
+
+  double best = 0;
+  for (int run = 0; run < runs; run++)
+  {
+    struct VM vm;
+    init_vm(&vm);
+    double start = now();
+    struct Script *script = cs_compile(&vm, src);
+    double elapsed = now() - start;
+    if (script == NULL)
+    {
+      fprintf(stderr, "compile failed\n");
+      return 1;
+    }
+    cs_free_script(script);
+    free_vm(&vm);
+    if (lines / elapsed > best)
+      best = lines / elapsed;
+  }
+  printf("%.0f lines/s\n", best);
+  free(src);
+  return 0;
+}
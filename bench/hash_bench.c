@@ -0,0 +1,78 @@
+#include "hash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+/*
+ * measures string hashing throughput for a range of key lengths and
+ * compares it with the byte at a time fnv-1a hash it replaced. reports
+ * bytes per cycle where a timestamp counter is available and bytes per
+ * nanosecond otherwise.
+ */
+
+static uint32_t fnv1a(const char *key, int length)
+{
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < length; i++)
+  {
+    hash ^= (uint8_t)key[i];
+    hash *= 16777619;
+  }
+  return hash;
+}
+
+static uint64_t ticks()
+{
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static double measure(uint32_t (*hash)(const char *, int), const char *buffer, int length,
+                      long total_bytes)
+{
+  long iterations = total_bytes / length;
+  uint32_t sink = 0;
+  uint64_t start = ticks();
+  for (long i = 0; i < iterations; i++)
+    sink += hash(buffer + (i & 63), length);
+  uint64_t elapsed = ticks() - start;
+  /* keep the loop from being optimized away */
+  if (sink == 0x12345678)
+    printf(" ");
+  return (double)(iterations * length) / (double)elapsed;
+}
+
+int main(int argc, char **argv)
+{
+  long total_bytes = argc > 1 ? atol(argv[1]) : 256l << 20;
+  static const int lengths[] = {4, 8, 16, 32, 64, 256, 1024, 4096, 65536};
+
+  init_hash_seed();
+  char *buffer = (char *)malloc(65536 + 64);
+  for (int i = 0; i < 65536 + 64; i++)
+    buffer[i] = (char)('a' + rand() % 26);
+
+#ifdef HAVE_TSC
+  printf("%8s %14s %14s\n", "length", "hash B/cycle", "fnv1a B/cycle");
+#else
+  printf("%8s %14s %14s\n", "length", "hash B/ns", "fnv1a B/ns");
+#endif
+  for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+  {
+    int length = lengths[i];
+    printf("%8d %14.3f %14.3f\n", length,
+           measure(hash_bytes, buffer, length, total_bytes),
+           measure(fnv1a, buffer, length, total_bytes / 4));
+  }
+  free(buffer);
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include "scanner.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * measures scanner throughput in MB/s on a generated script shaped like
+ * the machine generated ones we load: indented statements, long names,
+ * numbers, string literals and comments. every token is scanned, the
+ * best of several runs is reported.
+ */
+
+static const char *lines[] =
+{
+  "var request_handler_%d = 1234567.25 + base_offset_value * 42;\n",
+  "    // generated from the route table, entry %d, do not edit by hand\n",
+  "    print \"handler %d is registered for the default route\" + suffix;\n",
+  "  if (counter_%d > 1000) { total = total + counter_value; }\n",
+  "\n",
+  "        while (remaining_items_%d >= 0) remaining = remaining - 1;\n",
+};
+
+static double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char *generate(size_t size)
+{
+  char *src = (char *)malloc(size + 256);
+  size_t length = 0;
+  for (int i = 0; length < size; i++)
+    length += (size_t)sprintf(src + length, lines[i % 6], i);
+  return src;
+}
+
+int main(int argc, char **argv)
+{
+  size_t size = (argc > 1 ? (size_t)atol(argv[1]) : 16) << 20;
+  int runs = argc > 2 ? atoi(argv[2]) : 5;
+  char *src = generate(size);
+  size_t length = strlen(src);
+
+  double best = 0;
+  long tokens = 0;
+  int lines_seen = 0;
+  for (int run = 0; run < runs; run++)
+  {
+    struct Scanner scanner;
+    double start = now();
+    init_scanner(&scanner, src, length);
+    tokens = 0;
+    struct Token token;
+    do
+    {
+      token = scan_token(&scanner);
+      tokens++;
+    } while (token.type != TOKEN_EOF && token.type != TOKEN_ERROR);
+    double elapsed = now() - start;
+    lines_seen = token.line;
+    double rate = (double)length / elapsed / 1e6;
+    if (rate > best)
+      best = rate;
+  }
+  printf("%zu bytes, %ld tokens, %d lines: %.1f MB/s\n", length, tokens, lines_seen, best);
+  free(src);
+  return 0;
+}
@@ -7,7 +7,10 @@ void init_chunk(struct Chunk *chunk)
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
+  chunk->line_count = 0;
+  chunk->line_capacity = 0;
   chunk->lines = NULL;
+  chunk->max_stack = -1;
   init_value_array(&chunk->constants);
 }
 
@@ -19,18 +22,79 @@ void write_chunk(struct Chunk *chunk, uint8_t byte, int line)
     chunk->capacity = (curr_capacity < 8) ? 8 : curr_capacity * 2;
     chunk->code = (uint8_t *)reallocate(chunk->code, curr_capacity * sizeof(uint8_t),
                                                      chunk->capacity * sizeof(uint8_t));
-    chunk->lines = (int *)reallocate(chunk->lines, curr_capacity * sizeof(int),
-                                                   chunk->capacity * sizeof(int));
   }
   chunk->code[chunk->count] = byte;
-  chunk->lines[chunk->count] = line;
+
+  /* lines are stored once per run of bytes from the same line */
+  if (chunk->line_count == 0 || chunk->lines[chunk->line_count - 1].line != line)
+  {
+    if (chunk->line_capacity < chunk->line_count + 1)
+    {
+      int curr_capacity = chunk->line_capacity;
+      chunk->line_capacity = (curr_capacity < 8) ? 8 : curr_capacity * 2;
+      chunk->lines = (struct LineStart *)reallocate(chunk->lines,
+                                                    curr_capacity * sizeof(struct LineStart),
+                                                    chunk->line_capacity * sizeof(struct LineStart));
+    }
+    chunk->lines[chunk->line_count].offset = chunk->count;
+    chunk->lines[chunk->line_count].line = line;
+    chunk->line_count++;
+  }
   chunk->count++;
 }
 
+int get_line(struct Chunk *chunk, int offset)
+{
+  /* the last run starting at or before offset */
+  int low = 0;
+  int high = chunk->line_count - 1;
+  while (low < high)
+  {
+    int mid = low + (high - low + 1) / 2;
+    if (chunk->lines[mid].offset <= offset)
+      low = mid;
+    else
+      high = mid - 1;
+  }
+  return chunk->lines[low].line;
+}
+
+/* bytes following each opcode, a table so walking code does not branch on it */
+static const uint8_t operand_bytes[] =
+{
+  [OP_CONSTANT] = 1,
+  [OP_GETLOCAL] = 1,
+  [OP_SETLOCAL] = 1,
+  [OP_GETGLOBAL] = 1,
+  [OP_DEFINEGLOBAL] = 1,
+  [OP_SETGLOBAL] = 1,
+  [OP_CONCAT] = 1,
+  [OP_JMP] = 2,
+  [OP_JNT] = 2,
+  [OP_JL] = 2,
+  [OP_CONSTANT_LONG] = 3,
+  [OP_GETGLOBAL_LONG] = 3,
+  [OP_DEFINEGLOBAL_LONG] = 3,
+  [OP_SETGLOBAL_LONG] = 3,
+  [OP_GETLOCAL_LONG] = 3,
+  [OP_SETLOCAL_LONG] = 3,
+  [OP_JMP_LONG] = 4,
+  [OP_JNT_LONG] = 4,
+  [OP_JL_LONG] = 4,
+};
+
+int instruction_length(struct Chunk *chunk, int offset)
+{
+  uint8_t instruction = chunk->code[offset];
+  if (instruction >= sizeof(operand_bytes))
+    return 1;
+  return 1 + operand_bytes[instruction];
+}
+
 void free_chunk(struct Chunk *chunk)
 {
   reallocate(chunk->code, chunk->capacity * sizeof(uint8_t), 0);
-  reallocate(chunk->lines, chunk->capacity * sizeof(uint8_t), 0);
+  reallocate(chunk->lines, chunk->line_capacity * sizeof(struct LineStart), 0);
   free_value_array(&chunk->constants);
   init_chunk(chunk);
 }
@@ -29,20 +29,61 @@ enum Opcode
   OP_SETLOCAL,
   OP_GETGLOBAL,
   OP_DEFINEGLOBAL,
-  OP_SETGLOBAL
+  OP_SETGLOBAL,
+  OP_CONCAT,
+  OP_LEN,
+  OP_SUBSTR,
+  OP_CHARAT,
+  OP_FIND,
+  OP_CONTAINS,
+  OP_STARTSWITH,
+  OP_ENDSWITH,
+  OP_COUNT,
+  /* same as their short forms with a 24-bit constant index */
+  OP_CONSTANT_LONG,
+  OP_GETGLOBAL_LONG,
+  OP_DEFINEGLOBAL_LONG,
+  OP_SETGLOBAL_LONG,
+  /* jumps with a 32-bit offset, the compiler uses them only when needed */
+  OP_JMP_LONG,
+  OP_JNT_LONG,
+  OP_JL_LONG,
+  /* local slots past the first 256, 24-bit big-endian */
+  OP_GETLOCAL_LONG,
+  OP_SETLOCAL_LONG
 }; 
 
+/* most constants a chunk can refer to, the long opcodes take 3 bytes */
+#define CONSTANTS_MAX (1 << 24)
+/* most locals in scope at once, for the same reason */
+#define LOCALS_MAX (1 << 24)
+
+/* the first instruction of a run of code from the same source line */
+struct LineStart
+{
+  int offset;
+  int line;
+};
+
 struct Chunk
 {
   int count;
   int capacity;
   uint8_t *code;
-  int* lines;
+  int line_count;
+  int line_capacity;
+  struct LineStart *lines;
   struct ValueArray constants;
+  /* deepest the value stack gets running it, -1 until it is verified */
+  int max_stack;
 };
 
 void init_chunk(struct Chunk *chunk);
 void write_chunk(struct Chunk *chunk, uint8_t byte, int line);
+/* the source line of the code at offset */
+int get_line(struct Chunk *chunk, int offset);
+/* bytes taken by the instruction at offset, operands included */
+int instruction_length(struct Chunk *chunk, int offset);
 int add_constant(struct Chunk *chunk, Value value);
 void free_chunk(struct Chunk *chunk);
 
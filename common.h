@@ -5,8 +5,6 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define DEBUG_TRACE_EXECUTION
-
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #endif
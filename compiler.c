@@ -5,18 +5,45 @@
 #include "common.h"
 #include "compiler.h"
 #include "scanner.h"
+#include "tokens.h"
+#include "hash.h"
+#include "memory.h"
+#include "number.h"
+#include "verify.h"
 #include "object.h"
+#include "vm.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "assem.h"
 #endif
 
+struct ConstantSlot
+{
+  Value value;
+  int index;
+};
+
+/* the constant pool index of every value added so far, open addressing */
+struct ConstantMap
+{
+  struct ConstantSlot *slots;
+  int count;
+  int capacity;
+};
+
 struct Parser
 {
   struct Token curr;
   struct Token previous;
   bool had_err;
   bool panic_mode;
+  struct TokenStream tokens;
+  /* chunk size right after the last string literal was emitted */
+  int str_literal_end;
+  struct Compiler *current;
+  struct Chunk *chunk;
+  struct VM *vm;
+  struct ConstantMap constants;
 };
 
 enum Precedence
@@ -34,7 +61,7 @@ enum Precedence
   PREC_PRIMARY
 };
 
-typedef void (*ParseFn)(bool can_assign);
+typedef void (*ParseFn)(struct Parser *parser, bool can_assign);
 
 struct ParseRule
 {
@@ -46,38 +73,61 @@ struct ParseRule
 struct Local
 {
   struct Token name;
+  uint32_t hash;
   int depth;
+  /* the local with the same name this one hides, -1 if none */
+  int shadowed;
 };
 
-struct offset
+/*
+ * every name a local has had, mapped to the innermost local that has it
+ * right now or -1. names are never removed, so the table only grows with
+ * the number of distinct local names.
+ */
+struct LocalName
 {
-  int brk;
+  const char *start;
+  int length;
+  uint32_t hash;
+  int local;
+};
+
+struct Loop
+{
+  /* where continue jumps back to */
   int cont;
+  /* locals live at the loop's start and end, the rest are popped by a jump */
+  int cont_locals;
+  int break_locals;
+  /* operands of the break jumps, patched when the loop ends */
+  int *breaks;
+  int break_count;
+  int break_capacity;
 };
 
 struct Compiler
 {
-  struct Local locals[UINT8_COUNT];
+  struct Local *locals;
   int local_count;
+  int local_capacity;
+  struct LocalName *names;
+  int name_count;
+  int name_capacity;
   int scope_depth;
-  bool is_in_loop;
-  struct offset bc_offset[UINT8_COUNT];  
-  int bc_offset_count;
+  struct Loop *loops;
+  int loop_count;
+  int loop_capacity;
 };
 
-struct Parser parser;
-struct Compiler *current = NULL;
-struct Chunk *compiling_chunk;
-
-static struct Chunk *curr_chunk()
+static struct Chunk *curr_chunk(struct Parser *parser)
 {
-  return compiling_chunk;
+  return parser->chunk;
 }
 
-static void error_at(struct Token *token, const char *message)
+static void error_at(struct Parser *parser, struct Token *token, const char *message)
 {
-  if (parser.panic_mode) return;
-  parser.panic_mode = true;
+  if (parser->panic_mode) return;
+  parser->panic_mode = true;
   fprintf(stderr, "[line %d] Error", token->line);
 
   if (token->type == TOKEN_EOF)
@@ -87,359 +137,762 @@ static void error_at(struct Token *token, const char *message)
   else
     fprintf(stderr, " at '%.*s'", token->length, token->start);
   fprintf(stderr, ": %s\n", message);
-  parser.had_err = true;
+  parser->had_err = true;
 }
 
-static void error(const char *message)
+static void error(struct Parser *parser, const char *message)
 {
-  error_at(&parser.previous, message);
+  error_at(parser, &parser->previous, message);
 }
 
-static void error_at_curr(const char *message)
+static void error_at_curr(struct Parser *parser, const char *message)
 {
-  error_at(&parser.curr, message);
+  error_at(parser, &parser->curr, message);
 }
 
-static void advance()
+static void advance(struct Parser *parser)
 {
-  parser.previous = parser.curr;
+  parser->previous = parser->curr;
 
   for (;;)
   { 
-    parser.curr = scan_token();
-    if (parser.curr.type != TOKEN_ERROR)
+    parser->curr = next_token(&parser->tokens);
+    if (parser->curr.type != TOKEN_ERROR)
       break;
-    error_at_curr(parser.curr.start);
+    error_at_curr(parser, parser->curr.start);
   }
 }
 
-static void consume(enum TokenType type, const char *message)
+static void consume(struct Parser *parser, enum TokenType type, const char *message)
 {
-  if (parser.curr.type == type)
+  if (parser->curr.type == type)
   {
-    advance();
+    advance(parser);
     return;
   }
 
-  error_at_curr(message);
+  error_at_curr(parser, message);
 }
 
-static bool check(enum TokenType type)
+static bool check(struct Parser *parser, enum TokenType type)
 {
-  return parser.curr.type == type;
+  return parser->curr.type == type;
 }
 
-static bool match(enum TokenType type)
+static bool match(struct Parser *parser, enum TokenType type)
 {
-  if (!check(type))
+  if (!check(parser, type))
     return false;
-  advance();
+  advance(parser);
   return true;
 }
 
-static void emit_byte(uint8_t byte)
+static void emit_byte(struct Parser *parser, uint8_t byte)
 {
-  write_chunk(curr_chunk(), byte, parser.previous.line);
+  write_chunk(curr_chunk(parser), byte, parser->previous.line);
 }
 
-static void emit_bytes(uint8_t byte1, uint8_t byte2)
+static void emit_bytes(struct Parser *parser, uint8_t byte1, uint8_t byte2)
 {
-  emit_byte(byte1);
-  emit_byte(byte2);
+  emit_byte(parser, byte1);
+  emit_byte(parser, byte2);
 }
 
-static void emit_jl(int loop_start)
+static void emit_jl(struct Parser *parser, int loop_start)
 {
-  emit_byte(OP_JL);
-  
-  int offset = curr_chunk()->count - loop_start + 2;
-  if (offset > UINT16_MAX)
-    error("Loop body too large.");
-  emit_byte((offset >> 8) & 0xff);
-  emit_byte(offset & 0xff);
+  /* the distance back is known, so the short form is used whenever it fits */
+  int offset = curr_chunk(parser)->count - loop_start + 3;
+  if (offset <= UINT16_MAX)
+  {
+    emit_byte(parser, OP_JL);
+    emit_byte(parser, (offset >> 8) & 0xff);
+    emit_byte(parser, offset & 0xff);
+    return;
+  }
+
+  offset += 2;
+  emit_byte(parser, OP_JL_LONG);
+  emit_byte(parser, (offset >> 24) & 0xff);
+  emit_byte(parser, (offset >> 16) & 0xff);
+  emit_byte(parser, (offset >> 8) & 0xff);
+  emit_byte(parser, offset & 0xff);
 }
 
-static int emit_jmp(uint8_t instruction)
+/*
+ * forward jumps are always emitted long since their distance isn't known
+ * yet, shrink_jumps() narrows the ones that fit once the chunk is done
+ */
+static int emit_jmp(struct Parser *parser, uint8_t instruction)
 {
-  emit_byte(instruction);
-  emit_byte(0xff);
-  emit_byte(0xff);
-  return curr_chunk()->count - 2;
+  emit_byte(parser, instruction == OP_JMP ? OP_JMP_LONG : OP_JNT_LONG);
+  emit_byte(parser, 0xff);
+  emit_byte(parser, 0xff);
+  emit_byte(parser, 0xff);
+  emit_byte(parser, 0xff);
+  return curr_chunk(parser)->count - 4;
 }
 
-static void emit_return()
+static void emit_return(struct Parser *parser)
 {
-  emit_byte(OP_RETURN);
+  emit_byte(parser, OP_RETURN);
 }
 
-static uint8_t make_constant(Value value)
+/*
+ * constants are only ever numbers and strings. strings from the
+ * compiler are interned so the pointer stands for the contents, numbers
+ * compare by bits which keeps 0 and -0 apart.
+ */
+static uint32_t constant_hash(Value value)
 {
-  int constant = add_constant(curr_chunk(), value);
-  if (constant > UINT8_MAX)
+  uint64_t bits;
+  if (IS_NUMBER(value))
+    memcpy(&bits, &AS_NUMBER(value), sizeof(bits));
+  else
+    bits = (uint64_t)(uintptr_t)AS_OBJ(value);
+  return (uint32_t)((bits * 0x9e3779b97f4a7c15ull) >> 32);
+}
+
+static bool same_constant(Value a, Value b)
+{
+  if (a.type != b.type)
+    return false;
+  if (IS_NUMBER(a))
+    return memcmp(&AS_NUMBER(a), &AS_NUMBER(b), sizeof(double)) == 0;
+  return AS_OBJ(a) == AS_OBJ(b);
+}
+
+static void init_constant_map(struct ConstantMap *map)
+{
+  map->slots = NULL;
+  map->count = 0;
+  map->capacity = 0;
+}
+
+static void free_constant_map(struct ConstantMap *map)
+{
+  reallocate(map->slots, sizeof(struct ConstantSlot) * map->capacity, 0);
+  init_constant_map(map);
+}
+
+static struct ConstantSlot *find_constant(struct ConstantSlot *slots, int capacity, Value value)
+{
+  uint32_t index = constant_hash(value) & (capacity - 1);
+  for (;;)
   {
-    error("Too many constants in one chunk");
+    struct ConstantSlot *slot = &slots[index];
+    if (slot->index < 0 || same_constant(slot->value, value))
+      return slot;
+    index = (index + 1) & (capacity - 1);
+  }
+}
+
+static void grow_constant_map(struct ConstantMap *map)
+{
+  int capacity = map->capacity < 64 ? 64 : map->capacity * 2;
+  struct ConstantSlot *slots =
+    (struct ConstantSlot *)reallocate(NULL, 0, sizeof(struct ConstantSlot) * capacity);
+  for (int i = 0; i < capacity; i++)
+    slots[i].index = -1;
+  for (int i = 0; i < map->capacity; i++)
+  {
+    if (map->slots[i].index >= 0)
+      *find_constant(slots, capacity, map->slots[i].value) = map->slots[i];
+  }
+  reallocate(map->slots, sizeof(struct ConstantSlot) * map->capacity, 0);
+  map->slots = slots;
+  map->capacity = capacity;
+}
+
+/* the index of value in the constant pool, added the first time it is seen */
+static int make_constant(struct Parser *parser, Value value)
+{
+  struct ConstantMap *map = &parser->constants;
+  if ((map->count + 1) * 4 > map->capacity * 3)
+    grow_constant_map(map);
+  struct ConstantSlot *slot = find_constant(map->slots, map->capacity, value);
+  if (slot->index >= 0)
+    return slot->index;
+
+  if (curr_chunk(parser)->constants.count == CONSTANTS_MAX)
+  {
+    error(parser, "Too many constants in one chunk");
     return 0;
   }
+  slot->value = value;
+  slot->index = add_constant(curr_chunk(parser), value);
+  map->count++;
+  return slot->index;
+}
 
-  return (uint8_t)constant;
+/*
+ * the short form of op when the index fits a byte, the 24-bit one
+ * otherwise. local slots are encoded the same way.
+ */
+static void emit_constant_op(struct Parser *parser, uint8_t op, uint8_t long_op, int index)
+{
+  if (index <= UINT8_MAX)
+  {
+    emit_bytes(parser, op, (uint8_t)index);
+    return;
+  }
+  emit_byte(parser, long_op);
+  emit_byte(parser, (index >> 16) & 0xff);
+  emit_byte(parser, (index >> 8) & 0xff);
+  emit_byte(parser, index & 0xff);
 }
 
-static void emit_constant(Value value)
+static void emit_constant(struct Parser *parser, Value value)
 {
-  emit_bytes(OP_CONSTANT, make_constant(value));
+  emit_constant_op(parser, OP_CONSTANT, OP_CONSTANT_LONG, make_constant(parser, value));
 }
 
-static void patch_jmp(int offset)
+static void patch_jmp(struct Parser *parser, int offset)
 {
   if (offset < 0)
     return;
-  /* -2 means omitting 2 bytes from the jmp instruction that we will execute */
-  int jmp = curr_chunk()->count - offset - 2;
-  if (jmp > UINT16_MAX)
-    error("Too much code to jump over.");
+  /* -4 means omitting 4 bytes from the jmp instruction that we will execute */
+  int jmp = curr_chunk(parser)->count - offset - 4;
+
+  curr_chunk(parser)->code[offset] = (jmp >> 24) & 0xff;
+  curr_chunk(parser)->code[offset + 1] = (jmp >> 16) & 0xff;
+  curr_chunk(parser)->code[offset + 2] = (jmp >> 8) & 0xff;
+  curr_chunk(parser)->code[offset + 3] = jmp & 0xff;
+}
+
+static bool is_forward_long_jmp(uint8_t instruction)
+{
+  return instruction == OP_JMP_LONG || instruction == OP_JNT_LONG;
+}
+
+static int read_jmp(struct Chunk *chunk, int offset)
+{
+  uint8_t *operand = &chunk->code[offset + 1];
+  if (chunk->code[offset] == OP_JL)
+    return (operand[0] << 8) | operand[1];
+  return (operand[0] << 24) | (operand[1] << 16) | (operand[2] << 8) | operand[3];
+}
+
+/* a long forward jump that fits 16 bits, the distance can only shrink */
+static bool narrowable(struct Chunk *chunk, int offset)
+{
+  return is_forward_long_jmp(chunk->code[offset]) && read_jmp(chunk, offset) <= UINT16_MAX;
+}
+
+/*
+ * rewrites the finished chunk with every forward jump that fits 16 bits
+ * in its short form. targets are always instruction boundaries, each
+ * one is mapped to its new offset and the distances recomputed, taking
+ * bytes out never makes a jump longer so one pass is enough.
+ */
+static void shrink_jumps(struct Parser *parser)
+{
+  struct Chunk *chunk = curr_chunk(parser);
+  int *moved = (int *)reallocate(NULL, 0, sizeof(int) * (chunk->count + 1));
+  int removed = 0;
+  for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+  {
+    moved[offset] = offset - removed;
+    if (narrowable(chunk, offset))
+      removed += 2;
+  }
+  moved[chunk->count] = chunk->count - removed;
+
+  if (removed > 0)
+  {
+    struct Chunk narrow;
+    init_chunk(&narrow);
+    int run = 0;
+    for (int offset = 0; offset < chunk->count; offset += instruction_length(chunk, offset))
+    {
+      while (run + 1 < chunk->line_count && chunk->lines[run + 1].offset <= offset)
+        run++;
+      int line = chunk->lines[run].line;
+      uint8_t instruction = chunk->code[offset];
+      int length = instruction_length(chunk, offset);
+      if (instruction != OP_JL && instruction != OP_JL_LONG && !is_forward_long_jmp(instruction))
+      {
+        for (int i = 0; i < length; i++)
+          write_chunk(&narrow, chunk->code[offset + i], line);
+        continue;
+      }
+
+      bool forward = instruction != OP_JL && instruction != OP_JL_LONG;
+      int target = offset + length + (forward ? 1 : -1) * read_jmp(chunk, offset);
+      bool is_short = instruction == OP_JL || narrowable(chunk, offset);
+      int end = moved[offset] + (is_short ? 3 : 5);
+      int jmp = forward ? moved[target] - end : end - moved[target];
+      if (is_short)
+      {
+        write_chunk(&narrow, forward ? (instruction == OP_JMP_LONG ? OP_JMP : OP_JNT) : OP_JL, line);
+      }
+      else
+      {
+        write_chunk(&narrow, instruction, line);
+        write_chunk(&narrow, (jmp >> 24) & 0xff, line);
+        write_chunk(&narrow, (jmp >> 16) & 0xff, line);
+      }
+      write_chunk(&narrow, (jmp >> 8) & 0xff, line);
+      write_chunk(&narrow, jmp & 0xff, line);
+    }
 
-  curr_chunk()->code[offset] = (jmp >> 8) & 0xff;
-  curr_chunk()->code[offset + 1] = jmp & 0xff;
+    reallocate(chunk->code, chunk->capacity * sizeof(uint8_t), 0);
+    reallocate(chunk->lines, chunk->line_capacity * sizeof(struct LineStart), 0);
+    chunk->code = narrow.code;
+    chunk->count = narrow.count;
+    chunk->capacity = narrow.capacity;
+    chunk->lines = narrow.lines;
+    chunk->line_count = narrow.line_count;
+    chunk->line_capacity = narrow.line_capacity;
+  }
+  reallocate(moved, sizeof(int) * (chunk->count + removed + 1), 0);
 }
 
-static void init_compiler(struct Compiler *compiler)
+static void init_compiler(struct Parser *parser, struct Compiler *compiler)
 {
+  compiler->locals = NULL;
   compiler->local_count = 0;
+  compiler->local_capacity = 0;
+  compiler->names = NULL;
+  compiler->name_count = 0;
+  compiler->name_capacity = 0;
   compiler->scope_depth = 0;
-  compiler->is_in_loop = false;
-  compiler->bc_offset_count = -1;
-  current = compiler;
+  compiler->loops = NULL;
+  compiler->loop_count = 0;
+  compiler->loop_capacity = 0;
+  parser->current = compiler;
+}
+
+static void free_compiler(struct Compiler *compiler)
+{
+  for (int i = 0; i < compiler->loop_count; i++)
+    reallocate(compiler->loops[i].breaks, sizeof(int) * compiler->loops[i].break_capacity, 0);
+  reallocate(compiler->loops, sizeof(struct Loop) * compiler->loop_capacity, 0);
+  reallocate(compiler->names, sizeof(struct LocalName) * compiler->name_capacity, 0);
+  reallocate(compiler->locals, sizeof(struct Local) * compiler->local_capacity, 0);
 }
 
-static void end_compiler()
+static void end_compiler(struct Parser *parser)
 {
-  emit_return();
+  emit_return(parser);
+  if (!parser->had_err)
+  {
+    shrink_jumps(parser);
+    /* sizes the vm stack, and catches bad code from the compiler itself */
+    if (!verify_chunk(curr_chunk(parser)))
+      parser->had_err = true;
+  }
 #ifdef DEBUG_PRINT_CODE
-  if (!parser.had_err)
+  if (!parser->had_err)
 {
-    disassem_chunk(curr_chunk(), "code");
+    disassem_chunk(curr_chunk(parser), "code");
   }
 #endif
 }
 
-static void begin_loop()
+static struct Loop *curr_loop(struct Parser *parser)
 {
-  current->is_in_loop = true;
-  current->bc_offset_count++;
-  current->bc_offset[current->bc_offset_count].brk = -1;
-  current->bc_offset[current->bc_offset_count].cont = -1;
+  return &parser->current->loops[parser->current->loop_count - 1];
 }
 
-static void end_loop()
+static void begin_loop(struct Parser *parser)
 {
-  patch_jmp(current->bc_offset[current->bc_offset_count].brk);
-  current->bc_offset_count--;
-  current->is_in_loop = false;
+  struct Compiler *compiler = parser->current;
+  if (compiler->loop_count == compiler->loop_capacity)
+  {
+    int capacity = compiler->loop_capacity < 8 ? 8 : compiler->loop_capacity * 2;
+    compiler->loops = (struct Loop *)reallocate(compiler->loops,
+                                                sizeof(struct Loop) * compiler->loop_capacity,
+                                                sizeof(struct Loop) * capacity);
+    compiler->loop_capacity = capacity;
+  }
+  struct Loop *loop = &compiler->loops[compiler->loop_count++];
+  loop->cont = -1;
+  loop->cont_locals = compiler->local_count;
+  loop->break_locals = compiler->local_count;
+  loop->breaks = NULL;
+  loop->break_count = 0;
+  loop->break_capacity = 0;
 }
 
-static void begin_scope()
+static void set_loop_start(struct Parser *parser, int loop_start)
 {
-  current->scope_depth++;
+  curr_loop(parser)->cont = loop_start;
+  curr_loop(parser)->cont_locals = parser->current->local_count;
 }
 
-static void end_scope()
+/* break and continue leave scopes early, their locals come off the stack first */
+static void discard_locals(struct Parser *parser, int count)
 {
-  current->scope_depth--;
-  while (current->local_count > 0 &&
-         current->locals[current->local_count - 1].depth >
-         current->scope_depth)
+  for (int i = parser->current->local_count; i > count; i--)
+    emit_byte(parser, OP_POP);
+}
+
+static void end_loop(struct Parser *parser)
+{
+  struct Loop *loop = curr_loop(parser);
+  for (int i = 0; i < loop->break_count; i++)
+    patch_jmp(parser, loop->breaks[i]);
+  reallocate(loop->breaks, sizeof(int) * loop->break_capacity, 0);
+  parser->current->loop_count--;
+}
+
+static struct LocalName *find_name(struct LocalName *names, int capacity,
+                                   const struct Token *name, uint32_t hash)
+{
+  uint32_t index = hash & (capacity - 1);
+  for (;;)
   {
-    emit_byte(OP_POP);
-    current->local_count--;
+    struct LocalName *entry = &names[index];
+    if (entry->start == NULL ||
+        (entry->hash == hash && entry->length == name->length &&
+         memcmp(entry->start, name->start, name->length) == 0))
+      return entry;
+    index = (index + 1) & (capacity - 1);
   }
 }
 
-static void expression();
-static void statement();
-static void declaration();
+/* drops the innermost local, its name goes back to the one it hid */
+static void remove_local(struct Compiler *compiler)
+{
+  struct Local *local = &compiler->locals[--compiler->local_count];
+  find_name(compiler->names, compiler->name_capacity, &local->name, local->hash)->local = local->shadowed;
+}
+
+static void begin_scope(struct Parser *parser)
+{
+  parser->current->scope_depth++;
+}
+
+static void end_scope(struct Parser *parser)
+{
+  parser->current->scope_depth--;
+  while (parser->current->local_count > 0 &&
+         parser->current->locals[parser->current->local_count - 1].depth >
+         parser->current->scope_depth)
+  {
+    emit_byte(parser, OP_POP);
+    remove_local(parser->current);
+  }
+}
+
+static void expression(struct Parser *parser);
+static void statement(struct Parser *parser);
+static void declaration(struct Parser *parser);
 static struct ParseRule *get_rule(enum TokenType type);
-static void parse_precedence(enum Precedence precedence);
+static void parse_precedence(struct Parser *parser, enum Precedence precedence);
+
+/* true when the operand just compiled was a string literal */
+static bool ended_with_str_literal(struct Parser *parser)
+{
+  return curr_chunk(parser)->count == parser->str_literal_end;
+}
+
+/*
+ * a + b + c ... is compiled as one chain. until a string literal shows
+ * up every + is emitted as an OP_ADD right away, from then on the
+ * operands are left on the stack and joined by a single OP_CONCAT so
+ * the intermediate strings are never built
+ */
+static void add_chain(struct Parser *parser)
+{
+  bool fused = ended_with_str_literal(parser);
+  int pending = 1;
+  do
+  {
+    parse_precedence(parser, PREC_FACTOR);
+    pending++;
+    if (ended_with_str_literal(parser))
+      fused = true;
+    if (!fused)
+    {
+      emit_byte(parser, OP_ADD);
+      pending = 1;
+    }
+  } while (pending < UINT8_MAX && match(parser, TOKEN_PLUS));
 
-static void binary(bool can_assign)
+  if (pending > 1)
+    emit_bytes(parser, OP_CONCAT, pending);
+}
+
+static void binary(struct Parser *parser, bool can_assign)
 {
-  enum TokenType operator_type = parser.previous.type;
+  enum TokenType operator_type = parser->previous.type;
+  if (operator_type == TOKEN_PLUS)
+  {
+    add_chain(parser);
+    return;
+  }
   struct ParseRule *rule = get_rule(operator_type);
-  parse_precedence((enum Precedence)(rule->precedence + 1));
+  parse_precedence(parser, (enum Precedence)(rule->precedence + 1));
 
   switch (operator_type)
   {
     /* some of these are purely syntactic sugar */
     /* a != b is just a == !(b) */
-    case TOKEN_BANG_EQUAL:    emit_bytes(OP_EQUAL, OP_NOT); break;
-    case TOKEN_EQUAL_EQUAL:   emit_byte(OP_EQUAL); break;
-    case TOKEN_GREATER:       emit_byte(OP_GREATER); break;
-    case TOKEN_GREATER_EQUAL: emit_bytes(OP_LESS, OP_NOT); break;
-    case TOKEN_LESS:          emit_byte(OP_LESS); break;
-    case TOKEN_LESS_EQUAL:    emit_bytes(OP_GREATER, OP_NOT); break;
-    case TOKEN_PLUS:  emit_byte(OP_ADD); break;
-    case TOKEN_MINUS: emit_byte(OP_SUBTRACT); break;
-    case TOKEN_STAR:  emit_byte(OP_MULTIPLY); break;
-    case TOKEN_SLASH: emit_byte(OP_DIVIDE); break;
+    case TOKEN_BANG_EQUAL:    emit_bytes(parser, OP_EQUAL, OP_NOT); break;
+    case TOKEN_EQUAL_EQUAL:   emit_byte(parser, OP_EQUAL); break;
+    case TOKEN_GREATER:       emit_byte(parser, OP_GREATER); break;
+    case TOKEN_GREATER_EQUAL: emit_bytes(parser, OP_LESS, OP_NOT); break;
+    case TOKEN_LESS:          emit_byte(parser, OP_LESS); break;
+    case TOKEN_LESS_EQUAL:    emit_bytes(parser, OP_GREATER, OP_NOT); break;
+    case TOKEN_MINUS: emit_byte(parser, OP_SUBTRACT); break;
+    case TOKEN_STAR:  emit_byte(parser, OP_MULTIPLY); break;
+    case TOKEN_SLASH: emit_byte(parser, OP_DIVIDE); break;
     default:
       return; // Unreachable.
   }
 }
 
-static void literal(bool can_assign)
+static void literal(struct Parser *parser, bool can_assign)
 {
-  switch (parser.previous.type)
+  switch (parser->previous.type)
   {
-    case TOKEN_FALSE: emit_byte(OP_FALSE); break;
-    case TOKEN_NIL:   emit_byte(OP_NIL);   break;
-    case TOKEN_TRUE:  emit_byte(OP_TRUE);  break;
+    case TOKEN_FALSE: emit_byte(parser, OP_FALSE); break;
+    case TOKEN_NIL:   emit_byte(parser, OP_NIL);   break;
+    case TOKEN_TRUE:  emit_byte(parser, OP_TRUE);  break;
     default: return;
   }
 }
 
-static void grouping(bool can_assign)
+static void grouping(struct Parser *parser, bool can_assign)
 {
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression");
 }
 
-static void number(bool can_assign)
+static void number(struct Parser *parser, bool can_assign)
 {
-  double value = strtod(parser.previous.start, NULL);
-  emit_constant(NUMBER_VAL(value));
+  double value = parse_number(parser->previous.start, parser->previous.length);
+  emit_constant(parser, NUMBER_VAL(value));
 }
 
-static void or_(bool can_assign)
+static void or_(struct Parser *parser, bool can_assign)
 {
-  int else_jmp = emit_jmp(OP_JNT);
-  int end_jmp = emit_jmp(OP_JMP);
-  patch_jmp(else_jmp);
-  emit_byte(OP_POP);
-  parse_precedence(PREC_OR);
-  patch_jmp(end_jmp);
+  int else_jmp = emit_jmp(parser, OP_JNT);
+  int end_jmp = emit_jmp(parser, OP_JMP);
+  patch_jmp(parser, else_jmp);
+  emit_byte(parser, OP_POP);
+  parse_precedence(parser, PREC_OR);
+  patch_jmp(parser, end_jmp);
 }
 
-static void and_(bool can_assign)
+static void and_(struct Parser *parser, bool can_assign)
 {
-  int end_jmp = emit_jmp(OP_JNT);
+  int end_jmp = emit_jmp(parser, OP_JNT);
   /*
    * we dont need the value on the stack if
    * left hand expression not false then the
    * value of 'and' depends on the right expression
    */
-  emit_byte(OP_POP);
-  parse_precedence(PREC_AND);
-  patch_jmp(end_jmp);
+  emit_byte(parser, OP_POP);
+  parse_precedence(parser, PREC_AND);
+  patch_jmp(parser, end_jmp);
 }
 
-static void string(bool can_assign)
+static void string(struct Parser *parser, bool can_assign)
 {
-  struct ObjString *obj_str = copy_str(parser.previous.start + 1,
-                                       parser.previous.length - 2);
-  emit_constant(OBJ_VAL((struct Obj *)obj_str));
+  struct ObjString *obj_str = copy_str(parser->vm, parser->previous.start + 1,
+                                       parser->previous.length - 2);
+  emit_constant(parser, OBJ_VAL((struct Obj *)obj_str));
+  parser->str_literal_end = curr_chunk(parser)->count;
 }
 
-static uint8_t identifier_constant(const struct Token *name)
+static int identifier_constant(struct Parser *parser, const struct Token *name)
 {
-  return make_constant(OBJ_VAL(copy_str(name->start, name->length)));
+  return make_constant(parser, OBJ_VAL(copy_str(parser->vm, name->start, name->length)));
 }
 
-static bool identifiers_equal(struct Token *a, struct Token *b)
+static void grow_names(struct Compiler *compiler)
 {
-  if (a->length != b->length)
-    return false;
-  return memcmp(a->start, b->start, a->length) == 0;
-}
-
-static int resolve_local(struct Compiler *compiler, struct Token *name)
-{
-  for (int i = compiler->local_count - 1; i >= 0; i--)
+  int capacity = compiler->name_capacity < 16 ? 16 : compiler->name_capacity * 2;
+  struct LocalName *names = (struct LocalName *)reallocate(NULL, 0, sizeof(struct LocalName) * capacity);
+  for (int i = 0; i < capacity; i++)
+  {
+    names[i].start = NULL;
+    names[i].local = -1;
+  }
+  for (int i = 0; i < compiler->name_capacity; i++)
   {
-    struct Local *local = &compiler->locals[i];
-    if (identifiers_equal(name, &local->name))
+    struct LocalName *entry = &compiler->names[i];
+    if (entry->start != NULL)
     {
-      if (local->depth == -1)
-        error("Can't read local variable in its own initializer.");
-      return i;
+      struct Token name = {TOKEN_IDENTIFIER, entry->start, entry->length, 0};
+      *find_name(names, capacity, &name, entry->hash) = *entry;
     }
   }
+  reallocate(compiler->names, sizeof(struct LocalName) * compiler->name_capacity, 0);
+  compiler->names = names;
+  compiler->name_capacity = capacity;
+}
 
-  return -1;
+/* the innermost local called name, -1 when there is none */
+static int lookup_local(struct Compiler *compiler, const struct Token *name, uint32_t hash)
+{
+  if (compiler->name_count == 0)
+    return -1;
+  return find_name(compiler->names, compiler->name_capacity, name, hash)->local;
 }
 
-static void add_local(struct Token name)
+static int resolve_local(struct Parser *parser, struct Compiler *compiler, struct Token *name)
 {
-  if (current->local_count == UINT8_COUNT)
+  /* at the top level there are no locals, skip hashing every global */
+  if (compiler->local_count == 0)
+    return -1;
+
+  int i = lookup_local(compiler, name, hash_bytes(name->start, name->length));
+  if (i != -1 && compiler->locals[i].depth == -1)
+    error(parser, "Can't read local variable in its own initializer.");
+  return i;
+}
+
+static void add_local(struct Parser *parser, struct Token name, uint32_t hash)
+{
+  struct Compiler *compiler = parser->current;
+  if (compiler->local_count == LOCALS_MAX)
   {
-    error("Too many local variables in function.");
+    error(parser, "Too many local variables in function.");
     return;
   }
 
-  struct Local *local = &current->locals[current->local_count++];
+  if (compiler->local_count == compiler->local_capacity)
+  {
+    int capacity = compiler->local_capacity < 8 ? 8 : compiler->local_capacity * 2;
+    compiler->locals = (struct Local *)reallocate(compiler->locals,
+                                                  sizeof(struct Local) * compiler->local_capacity,
+                                                  sizeof(struct Local) * capacity);
+    compiler->local_capacity = capacity;
+  }
+  if ((compiler->name_count + 1) * 4 > compiler->name_capacity * 3)
+    grow_names(compiler);
+
+  struct LocalName *entry = find_name(compiler->names, compiler->name_capacity, &name, hash);
+  if (entry->start == NULL)
+  {
+    entry->start = name.start;
+    entry->length = name.length;
+    entry->hash = hash;
+    entry->local = -1;
+    compiler->name_count++;
+  }
+
+  struct Local *local = &compiler->locals[compiler->local_count];
   local->name = name;
+  local->hash = hash;
   local->depth = -1;
+  local->shadowed = entry->local;
+  entry->local = compiler->local_count++;
 }
 
-static void declare_variable()
+static void declare_variable(struct Parser *parser)
 {
-  if (current->scope_depth == 0)
+  if (parser->current->scope_depth == 0)
     return;
-  struct Token *name = &parser.previous;
-  for (int i = current->local_count - 1; i >= 0; i--)
-  {
-    struct Local *local = &current->locals[i];
-    if (local->depth != -1 && local->depth < current->scope_depth)
-      break;
+  struct Token *name = &parser->previous;
+  uint32_t hash = hash_bytes(name->start, name->length);
 
-    if (identifiers_equal(name, &local->name))
-      error("A variable with this name is already in the scope.");
+  /* only the innermost local of that name can be in the current scope */
+  int i = lookup_local(parser->current, name, hash);
+  if (i != -1)
+  {
+    struct Local *local = &parser->current->locals[i];
+    if (local->depth == -1 || local->depth >= parser->current->scope_depth)
+      error(parser, "A variable with this name is already in the scope.");
   }
-  add_local(*name);
+  add_local(parser, *name, hash);
 }
 
-static void named_variable(struct Token name, bool can_assign)
+static void named_variable(struct Parser *parser, struct Token name, bool can_assign)
 {
-  uint8_t get_op, set_op;
-  int arg = resolve_local(current, &name);
+  int arg = resolve_local(parser, parser->current, &name);
+  bool assign = match(parser, TOKEN_EQUAL) && can_assign;
+  if (assign)
+    expression(parser);
+
+  if (arg != -1 && assign)
+    emit_constant_op(parser, OP_SETLOCAL, OP_SETLOCAL_LONG, arg);
+  else if (arg != -1)
+    emit_constant_op(parser, OP_GETLOCAL, OP_GETLOCAL_LONG, arg);
+  else if (assign)
+    emit_constant_op(parser, OP_SETGLOBAL, OP_SETGLOBAL_LONG, identifier_constant(parser, &name));
+  else
+    emit_constant_op(parser, OP_GETGLOBAL, OP_GETGLOBAL_LONG, identifier_constant(parser, &name));
+}
 
-  if (arg != -1)
+struct Builtin
+{
+  const char *name;
+  enum Opcode op;
+  int arity;
+};
+
+/* native operations called like functions, each one is an opcode */
+static const struct Builtin builtins[] =
+{
+  {"len",        OP_LEN,        1},
+  {"substr",     OP_SUBSTR,     3},
+  {"charAt",     OP_CHARAT,     2},
+  {"find",       OP_FIND,       2},
+  {"contains",   OP_CONTAINS,   2},
+  {"startsWith", OP_STARTSWITH, 2},
+  {"endsWith",   OP_ENDSWITH,   2},
+  {"count",      OP_COUNT,      2},
+};
+
+static bool builtin_call(struct Parser *parser)
+{
+  const struct Builtin *builtin = NULL;
+  for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
   {
-    get_op = OP_GETLOCAL;
-    set_op = OP_SETLOCAL;
+    if ((int)strlen(builtins[i].name) == parser->previous.length &&
+        memcmp(builtins[i].name, parser->previous.start, parser->previous.length) == 0)
+      builtin = &builtins[i];
   }
-  else
+  if (builtin == NULL)
+    return false;
+
+  advance(parser);
+  int arg_count = 0;
+  if (!check(parser, TOKEN_RIGHT_PAREN))
   {
-    arg = identifier_constant(&name);
-    get_op = OP_GETGLOBAL;
-    set_op = OP_SETGLOBAL;
+    do
+    {
+      expression(parser);
+      arg_count++;
+    } while (match(parser, TOKEN_COMMA));
   }
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
 
-  if (match(TOKEN_EQUAL) && can_assign)
+  if (arg_count != builtin->arity)
   {
-    expression();
-    emit_bytes(set_op, (uint8_t)arg);
+    char message[64];
+    snprintf(message, sizeof(message), "Expected %d arguments but got %d.",
+             builtin->arity, arg_count);
+    error(parser, message);
   }
-  else
-    emit_bytes(get_op, (uint8_t)arg);
+  emit_byte(parser, builtin->op);
+  return true;
 }
 
-static void variable(bool can_assign)
+static void variable(struct Parser *parser, bool can_assign)
 {
-  named_variable(parser.previous, can_assign);
+  if (check(parser, TOKEN_LEFT_PAREN) && builtin_call(parser))
+    return;
+  named_variable(parser, parser->previous, can_assign);
 }
 
-static void unary(bool can_assign)
+static void unary(struct Parser *parser, bool can_assign)
 {
-  enum TokenType operator_type = parser.previous.type;
+  enum TokenType operator_type = parser->previous.type;
 
-  parse_precedence(PREC_UNARY);
+  parse_precedence(parser, PREC_UNARY);
 
   switch (operator_type)
   {
     case TOKEN_BANG:
-        emit_byte(OP_NOT);
+        emit_byte(parser, OP_NOT);
         break;
     case TOKEN_MINUS:
-        emit_byte(OP_NEGATE);
+        emit_byte(parser, OP_NEGATE);
         break;
     default:
         return;
@@ -490,58 +943,58 @@ struct ParseRule rules[] =
     [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
 };
 
-static void parse_precedence(enum Precedence precedence)
+static void parse_precedence(struct Parser *parser, enum Precedence precedence)
 {
-  advance();
-  ParseFn prefix_rule = get_rule(parser.previous.type)->prefix;
+  advance(parser);
+  ParseFn prefix_rule = get_rule(parser->previous.type)->prefix;
   if (prefix_rule == NULL)
   {
-    error("Expect expression.");
+    error(parser, "Expect expression.");
     return;
   }
 
   bool can_assign = precedence <= PREC_ASSIGNMENT;
-  prefix_rule(can_assign);
+  prefix_rule(parser, can_assign);
 
-  while (precedence <= get_rule(parser.curr.type)->precedence)
+  while (precedence <= get_rule(parser->curr.type)->precedence)
   {
-    advance();
-    ParseFn infix_rule = get_rule(parser.previous.type)->infix;
-    infix_rule(can_assign);
+    advance(parser);
+    ParseFn infix_rule = get_rule(parser->previous.type)->infix;
+    infix_rule(parser, can_assign);
   }
 
   /* there is no parsing function associated with = so we skip that loop */
-  if (can_assign && match(TOKEN_EQUAL))
+  if (can_assign && match(parser, TOKEN_EQUAL))
   {
-    error("Invalid assignment target.");
+    error(parser, "Invalid assignment target.");
   }
 }
 
 
 
-static uint8_t parse_variable(const char *err_msg)
+static int parse_variable(struct Parser *parser, const char *err_msg)
 {
-  consume(TOKEN_IDENTIFIER, err_msg);
-  declare_variable();
-  if (current->scope_depth > 0)
+  consume(parser, TOKEN_IDENTIFIER, err_msg);
+  declare_variable(parser);
+  if (parser->current->scope_depth > 0)
     return 0;
-  return identifier_constant(&parser.previous);
+  return identifier_constant(parser, &parser->previous);
 }
 
-static void mark_initialized()
+static void mark_initialized(struct Parser *parser)
 {
-  current->locals[current->local_count - 1].depth = current->scope_depth;
+  parser->current->locals[parser->current->local_count - 1].depth = parser->current->scope_depth;
 }
 
-static void define_variable(uint8_t global)
+static void define_variable(struct Parser *parser, int global)
 {
-  if (current->scope_depth > 0)
+  if (parser->current->scope_depth > 0)
   {
-    mark_initialized();
+    mark_initialized(parser);
     return;
   }
   
-  emit_bytes(OP_DEFINEGLOBAL, global);
+  emit_constant_op(parser, OP_DEFINEGLOBAL, OP_DEFINEGLOBAL_LONG, global);
 }
 
 
@@ -551,41 +1004,41 @@ static struct ParseRule *get_rule(enum TokenType type)
   return &rules[type];
 }
 
-static void expression()
+static void expression(struct Parser *parser)
 {
-  parse_precedence(PREC_ASSIGNMENT);
+  parse_precedence(parser, PREC_ASSIGNMENT);
 }
 
-static void block()
+static void block(struct Parser *parser)
 {
-  while (!check(TOKEN_RIGHT_BRACE) &&
-         !check(TOKEN_EOF))
-    declaration();
-  consume(TOKEN_RIGHT_BRACE, "Expect '}' after block");
+  while (!check(parser, TOKEN_RIGHT_BRACE) &&
+         !check(parser, TOKEN_EOF))
+    declaration(parser);
+  consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block");
 }
 
-static void var_declaration()
+static void var_declaration(struct Parser *parser)
 {
-  uint8_t global = parse_variable("Expect variable name.");
+  int global = parse_variable(parser, "Expect variable name.");
   
-  if (match(TOKEN_EQUAL))
-    expression();
+  if (match(parser, TOKEN_EQUAL))
+    expression(parser);
   else
-    emit_byte(OP_NIL);
+    emit_byte(parser, OP_NIL);
 
-  consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
-  define_variable(global);
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+  define_variable(parser, global);
 }
 
-static void synchronize()
+static void synchronize(struct Parser *parser)
 {
-  parser.panic_mode = false;
+  parser->panic_mode = false;
 
-  while (parser.curr.type != TOKEN_EOF)
+  while (parser->curr.type != TOKEN_EOF)
   {
-    if (parser.previous.type == TOKEN_SEMICOLON)
+    if (parser->previous.type == TOKEN_SEMICOLON)
       return;
-    switch (parser.curr.type)
+    switch (parser->curr.type)
     {
       case TOKEN_CLASS:
       case TOKEN_FUN:
@@ -600,183 +1053,211 @@ static void synchronize()
         ; // Do nothing.
     }
 
-    advance();
+    advance(parser);
   }
 }
 
-static void print_stmt()
+static void print_stmt(struct Parser *parser)
 {
-  expression();
-  consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-  emit_byte(OP_PRINT);
+  expression(parser);
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+  emit_byte(parser, OP_PRINT);
 }
 
-static void while_stmt()
+static void while_stmt(struct Parser *parser)
 {
-  begin_loop();
+  begin_loop(parser);
   /* constantly check for condition */
-  int loop_start = curr_chunk()->count;
-  current->bc_offset[current->bc_offset_count].cont = loop_start; 
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+  int loop_start = curr_chunk(parser)->count;
+  set_loop_start(parser, loop_start);
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-  int exit_jmp = emit_jmp(OP_JNT);
+  int exit_jmp = emit_jmp(parser, OP_JNT);
 
-  emit_byte(OP_POP);
-  statement();
-  emit_jl(loop_start);
+  emit_byte(parser, OP_POP);
+  statement(parser);
+  emit_jl(parser, loop_start);
 
-  patch_jmp(exit_jmp);
-  emit_byte(OP_POP);
-  end_loop();
+  patch_jmp(parser, exit_jmp);
+  emit_byte(parser, OP_POP);
+  end_loop(parser);
 }
 
-static void expression_stmt()
+static void expression_stmt(struct Parser *parser)
 {
-  expression();
-  consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-  emit_byte(OP_POP);
+  expression(parser);
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+  emit_byte(parser, OP_POP);
 }
 
-static void for_stmt()
+static void for_stmt(struct Parser *parser)
 {
-  begin_loop();
-  begin_scope();
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
-  if (match(TOKEN_SEMICOLON))
+  begin_loop(parser);
+  begin_scope(parser);
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  if (match(parser, TOKEN_SEMICOLON))
   {
   }
-  else if (match(TOKEN_VAR))
-    var_declaration();
+  else if (match(parser, TOKEN_VAR))
+    var_declaration(parser);
   else
-    expression_stmt();
+    expression_stmt(parser);
 
-  int loop_start = curr_chunk()->count;
+  int loop_start = curr_chunk(parser)->count;
   int exit_jmp = -1;
-  if (!match(TOKEN_SEMICOLON))
+  if (!match(parser, TOKEN_SEMICOLON))
   {
-    expression();
-    consume(TOKEN_SEMICOLON, "Expect ';'.");
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';'.");
     
-    exit_jmp = emit_jmp(OP_JNT);
-    emit_byte(OP_POP);
+    exit_jmp = emit_jmp(parser, OP_JNT);
+    emit_byte(parser, OP_POP);
   }
 
-  if (!match(TOKEN_RIGHT_PAREN))
+  if (!match(parser, TOKEN_RIGHT_PAREN))
   {
     /* jump over increment, we will execute this after we are done executing the body */
-    int body_jmp = emit_jmp(OP_JMP);
-    int increment_start = curr_chunk()->count;
-    expression();
-    emit_byte(OP_POP);
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+    int body_jmp = emit_jmp(parser, OP_JMP);
+    int increment_start = curr_chunk(parser)->count;
+    expression(parser);
+    emit_byte(parser, OP_POP);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
     
-    emit_jl(loop_start);
+    emit_jl(parser, loop_start);
     
     loop_start = increment_start;
-    patch_jmp(body_jmp); 
+    patch_jmp(parser, body_jmp); 
   }
-  current->bc_offset[current->bc_offset_count].cont = loop_start; 
-  statement();
-  emit_jl(loop_start);
+  set_loop_start(parser, loop_start);
+  statement(parser);
+  emit_jl(parser, loop_start);
   if (exit_jmp != -1)
   {
-    patch_jmp(exit_jmp);
-    emit_byte(OP_POP);
+    patch_jmp(parser, exit_jmp);
+    emit_byte(parser, OP_POP);
   }
-  end_scope();
-  end_loop();
+  end_scope(parser);
+  end_loop(parser);
 }
 
-static void break_stmt()
+static void break_stmt(struct Parser *parser)
 {
-  consume(TOKEN_SEMICOLON, "Expected ';' after 'break'.");
-  if (current->is_in_loop == false)
-    error("'break' can only be placed inside a loop.");
-  current->bc_offset[current->bc_offset_count].brk = emit_jmp(OP_JMP);
+  consume(parser, TOKEN_SEMICOLON, "Expected ';' after 'break'.");
+  if (parser->current->loop_count == 0)
+  {
+    error(parser, "'break' can only be placed inside a loop.");
+    return;
+  }
+
+  struct Loop *loop = curr_loop(parser);
+  if (loop->break_count == loop->break_capacity)
+  {
+    int capacity = loop->break_capacity < 4 ? 4 : loop->break_capacity * 2;
+    loop->breaks = (int *)reallocate(loop->breaks, sizeof(int) * loop->break_capacity,
+                                     sizeof(int) * capacity);
+    loop->break_capacity = capacity;
+  }
+  discard_locals(parser, loop->break_locals);
+  loop->breaks[loop->break_count++] = emit_jmp(parser, OP_JMP);
 }
 
-static void continue_stmt()
+static void continue_stmt(struct Parser *parser)
 { 
-  consume(TOKEN_SEMICOLON, "Expected ';' after 'continue'.");
-  if (current->is_in_loop == false)
-    error("'continue' can only be placed inside a loop.");
-  emit_jl(current->bc_offset[current->bc_offset_count].cont);
+  consume(parser, TOKEN_SEMICOLON, "Expected ';' after 'continue'.");
+  if (parser->current->loop_count == 0)
+  {
+    error(parser, "'continue' can only be placed inside a loop.");
+    return;
+  }
+  discard_locals(parser, curr_loop(parser)->cont_locals);
+  emit_jl(parser, curr_loop(parser)->cont);
 }
 
-static void if_stmt()
+static void if_stmt(struct Parser *parser)
 {
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-  int jmp_ova_then = emit_jmp(OP_JNT);
+  int jmp_ova_then = emit_jmp(parser, OP_JNT);
 /* condition met */
-  emit_byte(OP_POP);
-  statement();
-  int jmp_ova_else = emit_jmp(OP_JMP);
+  emit_byte(parser, OP_POP);
+  statement(parser);
+  int jmp_ova_else = emit_jmp(parser, OP_JMP);
 
-  patch_jmp(jmp_ova_then);
+  patch_jmp(parser, jmp_ova_then);
 
 /* condition not met */
-  emit_byte(OP_POP);
-  if (match(TOKEN_ELSE))
-    statement();
+  emit_byte(parser, OP_POP);
+  if (match(parser, TOKEN_ELSE))
+    statement(parser);
 
-  patch_jmp(jmp_ova_else);
+  patch_jmp(parser, jmp_ova_else);
 }
 
-static void declaration()
+static void declaration(struct Parser *parser)
 {
-  if (match(TOKEN_VAR))
-    var_declaration();
+  if (match(parser, TOKEN_VAR))
+    var_declaration(parser);
   else
-    statement();
+    statement(parser);
 
-  if (parser.panic_mode)
-    synchronize();
+  if (parser->panic_mode)
+    synchronize(parser);
 }
 
-static void statement()
+static void statement(struct Parser *parser)
 {
-  if (match(TOKEN_PRINT))
-    print_stmt();
-  else if (match(TOKEN_LEFT_BRACE))
+  if (match(parser, TOKEN_PRINT))
+    print_stmt(parser);
+  else if (match(parser, TOKEN_LEFT_BRACE))
   {
-    begin_scope();
-    block();
-    end_scope();
+    begin_scope(parser);
+    block(parser);
+    end_scope(parser);
   }
-  else if (match(TOKEN_IF))
-    if_stmt();
-  else if (match(TOKEN_WHILE))
-    while_stmt();
-  else if (match(TOKEN_FOR))
-    for_stmt();
-  else if (match(TOKEN_BREAK))
-    break_stmt();
-  else if (match(TOKEN_CONTINUE))
-    continue_stmt();
+  else if (match(parser, TOKEN_IF))
+    if_stmt(parser);
+  else if (match(parser, TOKEN_WHILE))
+    while_stmt(parser);
+  else if (match(parser, TOKEN_FOR))
+    for_stmt(parser);
+  else if (match(parser, TOKEN_BREAK))
+    break_stmt(parser);
+  else if (match(parser, TOKEN_CONTINUE))
+    continue_stmt(parser);
   else
-    expression_stmt();
+    expression_stmt(parser);
 }
 
 
 
-bool compile(const char *src, struct Chunk *chunk)
+bool compile(struct VM *vm, const char *src, size_t length, struct Chunk *chunk)
 {
-  init_scanner(src);
+  struct Parser parser;
   struct Compiler compiler;
-  init_compiler(&compiler);
-  compiling_chunk = chunk;
+  if (!open_tokens(&parser.tokens, src, length))
+  {
+    fprintf(stderr, "Source is too large to compile.\n");
+    return false;
+  }
+  init_compiler(&parser, &compiler);
+  parser.chunk = chunk;
+  parser.vm = vm;
 
   parser.had_err = false;
   parser.panic_mode = false;
-
-  advance();
-  while (!match(TOKEN_EOF))
-    declaration();
-  end_compiler();
+  parser.str_literal_end = -1;
+  init_constant_map(&parser.constants);
+
+  advance(&parser);
+  while (!match(&parser, TOKEN_EOF))
+    declaration(&parser);
+  end_compiler(&parser);
+  free_compiler(&compiler);
+  close_tokens(&parser.tokens);
+  free_constant_map(&parser.constants);
   return !parser.had_err;
 }
@@ -3,6 +3,9 @@
 
 #include "chunk.h"
 
-bool compile(const char *src, struct Chunk *chunk);
+struct VM;
+
+/* src is length bytes followed by a nul */
+bool compile(struct VM *vm, const char *src, size_t length, struct Chunk *chunk);
 
 #endif
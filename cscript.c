@@ -0,0 +1,78 @@
+#include "cscript.h"
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "table.h"
+#include <string.h>
+
+struct Script
+{
+  struct Chunk chunk;
+};
+
+struct Script *cs_compile(struct VM *vm, const char *src)
+{
+  struct Script *script = (struct Script *)reallocate(NULL, 0, sizeof(struct Script));
+  init_chunk(&script->chunk);
+
+  if (!compile(vm, src, strlen(src), &script->chunk))
+  {
+    cs_free_script(script);
+    return NULL;
+  }
+  return script;
+}
+
+enum InterpretResult cs_run(struct VM *vm, struct Script *script)
+{
+  return execute(vm, &script->chunk);
+}
+
+void cs_free_script(struct Script *script)
+{
+  if (script == NULL)
+    return;
+  free_chunk(&script->chunk);
+  reallocate(script, sizeof(struct Script), 0);
+}
+
+void cs_attach(struct VM *vm, struct Script *script)
+{
+  struct ValueArray *constants = &script->chunk.constants;
+  for (int i = 0; i < constants->count; i++)
+  {
+    if (IS_STRING(constants->values[i]))
+      table_set(&vm->strings, AS_STRING(constants->values[i]), NIL_VAL);
+  }
+}
+
+void cs_guard_stacks(void)
+{
+  guard_stacks();
+}
+
+Value cs_string(struct VM *vm, const char *c_str)
+{
+  /* host data, interning it would keep every input alive in the strings table */
+  return OBJ_VAL(copy_runtime_str(vm, c_str, (int)strlen(c_str)));
+}
+
+void cs_set_global(struct VM *vm, const char *name, Value value)
+{
+  table_set(&vm->globals, copy_str(vm, name, (int)strlen(name)), value);
+}
+
+bool cs_get_global(struct VM *vm, const char *name, Value *value)
+{
+  /* a name that was never interned cannot be a global, and probing must not intern it */
+  struct ObjString *key = find_str(vm, name, (int)strlen(name));
+  if (key == NULL || !table_get(&vm->globals, key, value))
+    return false;
+  /* hosts only ever see flat, nul terminated strings */
+  if (IS_ROPE(*value))
+    *value = OBJ_VAL(flatten_rope(vm, AS_ROPE(*value)));
+  if (IS_STRING(*value))
+    *value = OBJ_VAL(materialize_str(vm, AS_STRING(*value)));
+  return true;
+}
@@ -0,0 +1,51 @@
+#ifndef CSCRIPT_H_
+#define CSCRIPT_H_
+
+#include "common.h"
+#include "value.h"
+#include "vm.h"
+
+/*
+ * public embedding api
+ *
+ * cs_compile() scans and compiles a source string once and hands back
+ * a script handle, cs_run() only executes the prepared bytecode so a
+ * host can run the same script as many times as it wants without
+ * paying for the compiler again. globals live in the vm and persist
+ * between runs, the host can read and write them in between.
+ *
+ * every call takes the vm it works on, a vm carries no hidden global
+ * state so separate vms can be used from separate threads at the same
+ * time. call init_vm() on a vm before using it and free_vm() when done,
+ * string constants of a script are owned by the vm that compiled it so
+ * a script must not outlive that vm.
+ *
+ * a script is never modified by running it, so one compiled script can
+ * be run by many vms at once. call cs_attach() on every other vm that
+ * runs it (again after resetting that vm) so names the host interns
+ * there, like the ones passed to cs_set_global(), are the very objects
+ * the script's global opcodes look up.
+ */
+
+struct Script;
+
+struct Script *cs_compile(struct VM *vm, const char *src);
+enum InterpretResult cs_run(struct VM *vm, struct Script *script);
+void cs_free_script(struct Script *script);
+void cs_attach(struct VM *vm, struct Script *script);
+
+Value cs_string(struct VM *vm, const char *c_str);
+void cs_set_global(struct VM *vm, const char *name, Value value);
+bool cs_get_global(struct VM *vm, const char *name, Value *value);
+
+/*
+ * the library installs no signal handlers by itself. a host that calls
+ * this once, after setting up its own SIGSEGV handler, gets a value
+ * stack overflow reported as a runtime error on the line that caused
+ * it. without it a script whose stack could outgrow STACK_RESERVE is
+ * refused before it starts. faults that are not in a vm stack always go
+ * on to the host's handler.
+ */
+void cs_guard_stacks(void);
+
+#endif
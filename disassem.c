@@ -20,6 +20,17 @@ static int constant_instruction(const char *name,
   return offset + 2;
 }
 
+static int constant_long_instruction(const char *name, struct Chunk *chunk,
+                                     int offset)
+{
+  int constant = (chunk->code[offset + 1] << 16) | (chunk->code[offset + 2] << 8) |
+                 chunk->code[offset + 3];
+  printf("%-16s %4d [", name, constant);
+  print_value(chunk->constants.values[constant], true);
+  printf("]");
+  return offset + 4;
+}
+
 static int byte_instruction(const char *name, struct Chunk *chunk,
                             int offset)
 {
@@ -28,6 +39,15 @@ static int byte_instruction(const char *name, struct Chunk *chunk,
   return offset + 2;
 }
 
+static int long_instruction(const char *name, struct Chunk *chunk,
+                            int offset)
+{
+  int slot = (chunk->code[offset + 1] << 16) | (chunk->code[offset + 2] << 8) |
+             chunk->code[offset + 3];
+  printf("%-16s %4d %18s", name, slot, "");
+  return offset + 4;
+}
+
 static int jmp_instruction(const char *name, int sign,
                            struct Chunk *chunk, int offset)
 {
@@ -37,6 +57,68 @@ static int jmp_instruction(const char *name, int sign,
   return offset + 3;
 }
 
+static int jmp_long_instruction(const char *name, int sign,
+                                struct Chunk *chunk, int offset)
+{
+  int jmp = (chunk->code[offset + 1] << 24) | (chunk->code[offset + 2] << 16) |
+            (chunk->code[offset + 3] << 8) | chunk->code[offset + 4];
+  printf("%-16s %4d -> %04d %10s", name, offset, offset + 5 + sign * jmp, " ");
+  return offset + 5;
+}
+
+static const char *opcode_names[] =
+{
+  [OP_CONSTANT] = "OP_CONSTANT",
+  [OP_NIL] = "OP_NIL",
+  [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE",
+  [OP_ADD] = "OP_ADD",
+  [OP_SUBTRACT] = "OP_SUBTRACT",
+  [OP_MULTIPLY] = "OP_MULTIPLY",
+  [OP_DIVIDE] = "OP_DIVIDE",
+  [OP_NOT] = "OP_NOT",
+  [OP_NEGATE] = "OP_NEGATE",
+  [OP_PRINT] = "OP_PRINT",
+  [OP_JMP] = "OP_JMP",
+  [OP_JNT] = "OP_JNT",
+  [OP_JL] = "OP_JL",
+  [OP_RETURN] = "OP_RETURN",
+  [OP_GREATER] = "OP_GREATER",
+  [OP_LESS] = "OP_LESS",
+  [OP_EQUAL] = "OP_EQUAL",
+  [OP_POP] = "OP_POP",
+  [OP_GETLOCAL] = "OP_GETLOCAL",
+  [OP_SETLOCAL] = "OP_SETLOCAL",
+  [OP_GETGLOBAL] = "OP_GETGLOBAL",
+  [OP_DEFINEGLOBAL] = "OP_DEFINEGLOBAL",
+  [OP_SETGLOBAL] = "OP_SETGLOBAL",
+  [OP_CONCAT] = "OP_CONCAT",
+  [OP_LEN] = "OP_LEN",
+  [OP_SUBSTR] = "OP_SUBSTR",
+  [OP_CHARAT] = "OP_CHARAT",
+  [OP_FIND] = "OP_FIND",
+  [OP_CONTAINS] = "OP_CONTAINS",
+  [OP_STARTSWITH] = "OP_STARTSWITH",
+  [OP_ENDSWITH] = "OP_ENDSWITH",
+  [OP_COUNT] = "OP_COUNT",
+  [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+  [OP_GETGLOBAL_LONG] = "OP_GETGLOBAL_LONG",
+  [OP_DEFINEGLOBAL_LONG] = "OP_DEFINEGLOBAL_LONG",
+  [OP_SETGLOBAL_LONG] = "OP_SETGLOBAL_LONG",
+  [OP_JMP_LONG] = "OP_JMP_LONG",
+  [OP_JNT_LONG] = "OP_JNT_LONG",
+  [OP_JL_LONG] = "OP_JL_LONG",
+  [OP_GETLOCAL_LONG] = "OP_GETLOCAL_LONG",
+  [OP_SETLOCAL_LONG] = "OP_SETLOCAL_LONG",
+};
+
+const char *opcode_name(uint8_t opcode)
+{
+  if (opcode >= sizeof(opcode_names) / sizeof(opcode_names[0]) || opcode_names[opcode] == NULL)
+    return "OP_UNKNOWN";
+  return opcode_names[opcode];
+}
+
 void disassem_chunk(struct Chunk *chunk, const char *name)
 {
   printf("DISASSEMBLING CHUNK: %s\n", name);
@@ -47,62 +129,68 @@ void disassem_chunk(struct Chunk *chunk, const char *name)
 int disassem_instruction(struct Chunk *chunk, int offset)
 {
   printf("%04d ", offset);
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1])
+  int line = get_line(chunk, offset);
+  if (offset > 0 && line == get_line(chunk, offset - 1))
     printf("   | ");
   else
-    printf("%4d ", chunk->lines[offset]);
+    printf("%4d ", line);
 
   uint8_t instruction = chunk->code[offset];
+  /* names come from opcode_name() only, the cases just pick the operand layout */
+  const char *name = opcode_name(instruction);
   switch (instruction)
   {
-    case OP_CONSTANT:
-      return constant_instruction("OP_CONSTANT", chunk, offset);
     case OP_NIL:
-      return simple_instruction("OP_NIL", offset);
     case OP_TRUE:
-      return simple_instruction("OP_TRUE", offset);
     case OP_FALSE:
-      return simple_instruction("OP_FALSE", offset);
     case OP_EQUAL:
-      return simple_instruction("OP_EQUAL", offset);
     case OP_POP:
-      return simple_instruction("OP_POP", offset);
     case OP_GREATER:
-      return simple_instruction("OP_GREATER", offset);
     case OP_LESS:
-      return simple_instruction("OP_LESS", offset);
     case OP_ADD:
-      return simple_instruction("OP_ADD", offset);
     case OP_SUBTRACT:
-      return simple_instruction("OP_SUBTRACT", offset);
     case OP_MULTIPLY:
-      return simple_instruction("OP_MULTIPLY", offset);
     case OP_DIVIDE:
-      return simple_instruction("OP_DIVIDE", offset);
     case OP_NOT:
-      return simple_instruction("OP_NOT", offset);
     case OP_NEGATE:
-      return simple_instruction("OP_NEGATE", offset);
     case OP_PRINT:
-      return simple_instruction("OP_PRINT", offset);
-    case OP_JMP:
-      return jmp_instruction("OP_JMP", 1, chunk, offset);
-    case OP_JL:
-      return jmp_instruction("OP_JL", -1, chunk, offset);
-    case OP_JNT:
-      return jmp_instruction("OP_JNT", 1, chunk, offset);
     case OP_RETURN:
-      return simple_instruction("OP_RETURN", offset);
-   case OP_SETGLOBAL:
-      return constant_instruction("OP_SETGLOBAL", chunk, offset);
-   case OP_GETGLOBAL:
-      return constant_instruction("OP_GETGLOBAL", chunk, offset);
+    case OP_LEN:
+    case OP_SUBSTR:
+    case OP_CHARAT:
+    case OP_FIND:
+    case OP_CONTAINS:
+    case OP_STARTSWITH:
+    case OP_ENDSWITH:
+    case OP_COUNT:
+      return simple_instruction(name, offset);
+    case OP_CONSTANT:
+    case OP_SETGLOBAL:
+    case OP_GETGLOBAL:
     case OP_DEFINEGLOBAL:
-      return constant_instruction("OP_DEFINEGLOBAL", chunk, offset); 
+      return constant_instruction(name, chunk, offset);
     case OP_SETLOCAL:
-      return byte_instruction("OP_SETLOCAL", chunk, offset); 
     case OP_GETLOCAL:
-      return byte_instruction("OP_GETLOCAL", chunk, offset); 
+    case OP_CONCAT:
+      return byte_instruction(name, chunk, offset);
+    case OP_JMP:
+    case OP_JNT:
+      return jmp_instruction(name, 1, chunk, offset);
+    case OP_JL:
+      return jmp_instruction(name, -1, chunk, offset);
+    case OP_CONSTANT_LONG:
+    case OP_GETGLOBAL_LONG:
+    case OP_DEFINEGLOBAL_LONG:
+    case OP_SETGLOBAL_LONG:
+      return constant_long_instruction(name, chunk, offset);
+    case OP_JMP_LONG:
+    case OP_JNT_LONG:
+      return jmp_long_instruction(name, 1, chunk, offset);
+    case OP_JL_LONG:
+      return jmp_long_instruction(name, -1, chunk, offset);
+    case OP_GETLOCAL_LONG:
+    case OP_SETLOCAL_LONG:
+      return long_instruction(name, chunk, offset);
     default:
       printf("Unknown opcode %d", instruction);
       return offset + 1;
@@ -5,5 +5,7 @@
 
 void disassem_chunk(struct Chunk *chunk, const char *name);
 int disassem_instruction(struct Chunk *chunk, int offset);
+/* "OP_ADD" for OP_ADD and so on */
+const char *opcode_name(uint8_t opcode);
 
 #endif
@@ -0,0 +1,124 @@
+#include "hash.h"
+#include <pthread.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * wyhash style string hash, it reads 8 bytes at a time and mixes them
+ * with 64x64->128 bit multiplies, long inputs run three independent
+ * lanes. the seed is picked at random once per process so nobody can
+ * precompute a set of strings that all land in one probe sequence.
+ */
+
+static const uint64_t secret[4] =
+{
+  0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull,
+  0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+static uint64_t hash_seed;
+static pthread_once_t seed_once = PTHREAD_ONCE_INIT;
+
+static void pick_seed()
+{
+  uint64_t seed;
+  if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed))
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    seed = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)getpid();
+  }
+  hash_seed = seed;
+}
+
+void init_hash_seed()
+{
+  pthread_once(&seed_once, pick_seed);
+}
+
+static inline void mum(uint64_t *a, uint64_t *b)
+{
+  __uint128_t r = (__uint128_t)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b)
+{
+  mum(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t read32(const uint8_t *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t hash_bytes(const char *key, int length)
+{
+  const uint8_t *p = (const uint8_t *)key;
+  size_t len = (size_t)length;
+  uint64_t seed = hash_seed ^ mix(hash_seed ^ secret[0], secret[1]);
+  uint64_t a, b;
+
+  if (len <= 16)
+  {
+    if (len >= 4)
+    {
+      /* two possibly overlapping 4 byte reads from each end */
+      size_t mid = (len >> 3) << 2;
+      a = (read32(p) << 32) | read32(p + mid);
+      b = (read32(p + len - 4) << 32) | read32(p + len - 4 - mid);
+    }
+    else if (len > 0)
+    {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    }
+    else
+      a = b = 0;
+  }
+  else
+  {
+    size_t i = len;
+    if (i > 48)
+    {
+      uint64_t see1 = seed, see2 = seed;
+      do
+      {
+        seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+        see1 = mix(read64(p + 16) ^ secret[2], read64(p + 24) ^ see1);
+        see2 = mix(read64(p + 32) ^ secret[3], read64(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16)
+    {
+      seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    /* the last 16 bytes, overlapping what was already mixed */
+    a = read64(p + i - 16);
+    b = read64(p + i - 8);
+  }
+
+  a ^= secret[1];
+  b ^= seed;
+  mum(&a, &b);
+  uint64_t hash = mix(a ^ secret[0] ^ len, b ^ secret[1]);
+  return (uint32_t)(hash ^ (hash >> 32));
+}
@@ -0,0 +1,9 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include "common.h"
+
+void init_hash_seed();
+uint32_t hash_bytes(const char *key, int length);
+
+#endif
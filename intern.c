@@ -0,0 +1,115 @@
+#include "intern.h"
+#include "memory.h"
+#include "object.h"
+#include <stdatomic.h>
+#include <string.h>
+
+/*
+ * a fixed array of buckets, each one the head of a singly linked list
+ * of strings chained through obj.next (shared strings are never on a
+ * vm's object list so the field is free). a string is fully built
+ * before it is published with a release cas on its bucket head and is
+ * never changed afterwards, so lookups are plain acquire loads and list
+ * walks without any locking. inserts only contend with other inserts
+ * into the same bucket.
+ */
+
+struct SharedStrings
+{
+  _Atomic(struct ObjString *) *buckets;
+  uint32_t mask;
+};
+
+static struct SharedStrings shared;
+
+void init_shared_strings(int bucket_bits)
+{
+  uint32_t count = 1u << bucket_bits;
+  shared.buckets = (_Atomic(struct ObjString *) *)reallocate(NULL, 0,
+                                                  sizeof(*shared.buckets) * count);
+  for (uint32_t i = 0; i < count; i++)
+    atomic_init(&shared.buckets[i], NULL);
+  shared.mask = count - 1;
+}
+
+void free_shared_strings()
+{
+  if (shared.buckets == NULL)
+    return;
+  for (uint32_t i = 0; i <= shared.mask; i++)
+  {
+    struct ObjString *string = atomic_load(&shared.buckets[i]);
+    while (string != NULL)
+    {
+      struct ObjString *next = (struct ObjString *)string->obj.next;
+      reallocate(string, sizeof(struct ObjString) + string->length + 1, 0);
+      string = next;
+    }
+  }
+  reallocate(shared.buckets, sizeof(*shared.buckets) * (shared.mask + 1), 0);
+  shared.buckets = NULL;
+  shared.mask = 0;
+}
+
+bool shared_strings_enabled()
+{
+  return shared.buckets != NULL;
+}
+
+/* walks a chain from string up to (not including) stop */
+static struct ObjString *find_in_chain(struct ObjString *string, struct ObjString *stop,
+                                       const char *c_str, int length, uint32_t hash)
+{
+  for (; string != stop; string = (struct ObjString *)string->obj.next)
+  {
+    if (string->hash == hash && string->length == length &&
+        memcmp(string->chars, c_str, length) == 0)
+      return string;
+  }
+  return NULL;
+}
+
+struct ObjString *find_shared(const char *c_str, int length, uint32_t hash)
+{
+  _Atomic(struct ObjString *) *bucket = &shared.buckets[hash & shared.mask];
+  return find_in_chain(atomic_load_explicit(bucket, memory_order_acquire), NULL,
+                       c_str, length, hash);
+}
+
+struct ObjString *intern_shared(const char *c_str, int length, uint32_t hash)
+{
+  _Atomic(struct ObjString *) *bucket = &shared.buckets[hash & shared.mask];
+  struct ObjString *head = atomic_load_explicit(bucket, memory_order_acquire);
+  struct ObjString *interned = find_in_chain(head, NULL, c_str, length, hash);
+  if (interned != NULL)
+    return interned;
+
+  struct ObjString *string = (struct ObjString *)reallocate(NULL, 0,
+                                               sizeof(struct ObjString) + length + 1);
+  string->obj.type = OBJ_STRING;
+  string->hash = hash;
+  string->interned = true;
+  string->length = length;
+  string->chars = string->c_str;
+  string->parent = NULL;
+  memcpy(string->c_str, c_str, length);
+  string->c_str[length] = '\0';
+
+  for (;;)
+  {
+    struct ObjString *seen = head;
+    string->obj.next = (struct Obj *)head;
+    if (atomic_compare_exchange_weak_explicit(bucket, &head, string,
+                                              memory_order_release,
+                                              memory_order_acquire))
+      return string;
+
+    /* only strings pushed since we last looked can be a duplicate */
+    interned = find_in_chain(head, seen, c_str, length, hash);
+    if (interned != NULL)
+    {
+      reallocate(string, sizeof(struct ObjString) + length + 1, 0);
+      return interned;
+    }
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef INTERN_H_
+#define INTERN_H_
+
+#include "common.h"
+
+/*
+ * optional process-wide string intern table
+ *
+ * once init_shared_strings() has been called every vm interns its
+ * strings here instead of in its own vm->strings, so the same text is
+ * the same struct ObjString in all vms and pointer equality keeps
+ * working across them. it has to be set up before the first vm is
+ * created and torn down after the last one is freed, strings interned
+ * here belong to the table and live until free_shared_strings().
+ *
+ * the table never grows, so only names go in: string constants and
+ * identifiers of compiled scripts and the names hosts pass to
+ * cs_set_global(). strings built at runtime and cs_string() values are
+ * never interned, whatever the scripts are run on.
+ */
+
+struct ObjString;
+
+void init_shared_strings(int bucket_bits);
+void free_shared_strings();
+bool shared_strings_enabled();
+struct ObjString *intern_shared(const char *c_str, int length, uint32_t hash);
+/* the interned string with these characters, NULL instead of adding one */
+struct ObjString *find_shared(const char *c_str, int length, uint32_t hash);
+
+#endif
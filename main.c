@@ -5,9 +5,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include "table.h"
+#include "batch.h"
+#include "cscript.h"
+#include "server.h"
+#include "source.h"
 
-static void repl()
+static void repl(struct VM *vm)
 {
   char line[1024];
   for (;;)
@@ -20,62 +25,231 @@ static void repl()
     }
     if (strcmp(line, "exit\n") == 0)
       break;
-    interpret(line);
+    interpret(vm, line, strlen(line));
   }
 }
 
-static char *read_file(const char *path)
+/* "-" reads standard input */
+static void read_file(const char *path, struct Source *source)
 {
-  FILE *file = fopen(path, "rb");
-  if (file == NULL)
+  if (!load_source(source, path))
   {
-    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    fprintf(stderr, "Could not read file \"%s\": %s.\n", path, strerror(errno));
     exit(74);
   }
-  fseek(file, 0L, SEEK_END);
-  size_t file_sz = ftell(file);
-  rewind(file);
-  char *buffer = (char *)malloc(file_sz + 1);
-  if (buffer == NULL)
+}
+
+static int run_file(struct VM *vm, const char *path)
+{
+  struct Source source;
+  read_file(path, &source);
+  enum InterpretResult result = interpret(vm, source.text, source.length);
+  free_source(&source);
+
+  if (result == INTERPRET_COMPILE_ERR) return 65;
+  if (result == INTERPRET_RUNTIME_ERR) return 70;
+  return 0;
+}
+
+/* splits an argument list file into one argument string per line */
+static char **read_args(const char *path, int *count)
+{
+  struct Source source;
+  read_file(path, &source);
+  char *buffer = source.text;
+  int capacity = 8;
+  char **args = (char **)malloc(sizeof(char *) * capacity);
+  *count = 0;
+  for (char *line = strtok(buffer, "\n"); line != NULL; line = strtok(NULL, "\n"))
   {
-    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-    exit(74);
+    if (*count == capacity)
+    {
+      capacity *= 2;
+      args = (char **)realloc(args, sizeof(char *) * capacity);
+    }
+    args[(*count)++] = line;
   }
-  size_t bytes_read = fread(buffer, sizeof(char), file_sz, file);
-  if (bytes_read < file_sz)
+  return args;
+}
+
+static int batch(int argc, char **argv)
+{
+  struct BatchOptions opts;
+  opts.threads = 0;
+  opts.inputs_are_args = false;
+  opts.shared_strings = false;
+
+  int i = 0;
+  const char *args_path = NULL;
+  for (; i < argc && argv[i][0] == '-'; i++)
   {
-    fprintf(stderr, "Could read file \"%s\".\n", path);
-    exit(74);
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+      opts.threads = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--args") == 0 && i + 1 < argc)
+      args_path = argv[++i];
+    else if (strcmp(argv[i], "--shared-strings") == 0)
+      opts.shared_strings = true;
+    else
+      break;
+  }
+  if (i >= argc)
+  {
+    fprintf(stderr, "Usage: C-Script --batch [-j threads] [--args file] [--shared-strings] script [inputs...]\n");
+    return 64;
+  }
+
+  struct Source src;
+  read_file(argv[i++], &src);
+  if (args_path != NULL)
+  {
+    opts.inputs = read_args(args_path, &opts.input_count);
+    opts.inputs_are_args = true;
   }
-  buffer[bytes_read] = '\0';
-  fclose(file);
-  return buffer;
+  else
+  {
+    opts.inputs = argv + i;
+    opts.input_count = argc - i;
+  }
+  opts.src = src.text;
+
+  int status = run_batch(&opts);
+  free_source(&src);
+  return status;
 }
 
-static void run_file(const char *path)
+static int serve(int argc, char **argv)
 {
-  char *src = read_file(path);
-  enum InterpretResult result = interpret(src);
-  free(src);
+  struct ServerOptions opts;
+  opts.prelude = NULL;
+  opts.socket_path = NULL;
 
-  if (result == INTERPRET_COMPILE_ERR) exit(65);
-  if (result == INTERPRET_RUNTIME_ERR) exit(70);
+  int i = 0;
+  const char *prelude_path = NULL;
+  for (; i < argc && argv[i][0] == '-'; i++)
+  {
+    if (strcmp(argv[i], "--prelude") == 0 && i + 1 < argc)
+      prelude_path = argv[++i];
+    else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc)
+      opts.socket_path = argv[++i];
+    else
+      break;
+  }
+  if (i + 1 != argc)
+  {
+    fprintf(stderr, "Usage: C-Script --serve [--prelude file] [--socket path] script\n");
+    return 64;
+  }
+
+  struct Source src;
+  struct Source prelude = {NULL, 0, 0};
+  read_file(argv[i], &src);
+  if (prelude_path != NULL)
+    read_file(prelude_path, &prelude);
+  opts.src = src.text;
+  opts.prelude = prelude.text;
+
+  int status = run_server(&opts);
+  free_source(&prelude);
+  free_source(&src);
+  return status;
 }
 
 int main(int argc, char **argv)
 {
-  init_vm();
-  
-  if (argc == 1)
-    repl();
-  else if (argc == 2)
-    run_file(argv[1]);
+  cs_guard_stacks();
+  if (argc > 1 && strcmp(argv[1], "--batch") == 0)
+    return batch(argc - 2, argv + 2);
+  if (argc > 1 && strcmp(argv[1], "--serve") == 0)
+    return serve(argc - 2, argv + 2);
+
+  bool table_stats = false;
+  const char *trace_path = NULL;
+  bool profile_opcodes = false;
+  const char *sample_path = NULL;
+  int i = 1;
+  for (; i < argc && strncmp(argv[i], "--", 2) == 0; i++)
+  {
+    if (strcmp(argv[i], "--table-stats") == 0)
+      table_stats = true;
+    else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      trace_path = argv[++i];
+    else if (strcmp(argv[i], "--profile-opcodes") == 0)
+      profile_opcodes = true;
+    else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc)
+      sample_path = argv[++i];
+    else
+      break;
+  }
+
+  struct VM vm;
+  init_vm(&vm);
+  struct Trace trace;
+  if (trace_path != NULL)
+  {
+    init_trace(&trace, TRACE_EVENTS);
+    vm.trace = &trace;
+  }
+  struct Profile profile;
+  if (profile_opcodes)
+  {
+    init_profile(&profile);
+    vm.profile = &profile;
+  }
+  struct Sampler sampler;
+  if (sample_path != NULL)
+  {
+    init_sampler(&sampler, i == argc ? "repl" : strcmp(argv[i], "-") == 0 ? "stdin" : argv[i]);
+    if (!start_sampler(&sampler))
+    {
+      perror("timer_create");
+      exit(1);
+    }
+    vm.sampler = &sampler;
+  }
+
+  int status = 0;
+  if (i == argc)
+    repl(&vm);
+  else if (i + 1 == argc)
+    status = run_file(&vm, argv[i]);
   else
   {
-    fprintf(stderr, "Usage: clox [path]\n");
+    fprintf(stderr, "Usage: C-Script [--table-stats] [--trace file] [--profile-opcodes] [--sample-profile file] [path | -]\n"
+                    "       C-Script --batch [-j threads] [--args file] [--shared-strings] script [inputs...]\n"
+                    "       C-Script --serve [--prelude file] [--socket path] script\n");
     exit(64);
   }
 
-  free_vm();
-  return 0;
+  if (trace_path != NULL)
+  {
+    FILE *file = fopen(trace_path, "wb");
+    if (file == NULL || !write_trace(&trace, file))
+      fprintf(stderr, "Could not write trace \"%s\": %s.\n", trace_path, strerror(errno));
+    if (file != NULL)
+      fclose(file);
+    free_trace(&trace);
+  }
+  if (profile_opcodes)
+  {
+    print_profile(&profile, stderr);
+    free_profile(&profile);
+  }
+  if (sample_path != NULL)
+  {
+    stop_sampler(&sampler);
+    FILE *file = fopen(sample_path, "w");
+    if (file == NULL || !write_samples(&sampler, file))
+      fprintf(stderr, "Could not write samples \"%s\": %s.\n", sample_path, strerror(errno));
+    if (file != NULL)
+      fclose(file);
+    free_sampler(&sampler);
+  }
+
+  if (table_stats)
+  {
+    print_table_stats("globals", &vm.globals);
+    print_table_stats("strings", &vm.strings);
+  }
+  free_vm(&vm);
+  return status;
 }
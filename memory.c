@@ -24,16 +24,20 @@ static void free_obj(struct Obj *obj)
     case OBJ_STRING:
     {
       struct ObjString *obj_str = (struct ObjString *)obj;
-      reallocate(obj_str, sizeof(struct ObjString) +
-                         (sizeof(char) * obj_str->length + 1), 0);
+      /* slices have no characters of their own */
+      size_t chars_sz = obj_str->parent != NULL ? 0 : sizeof(char) * obj_str->length + 1;
+      reallocate(obj_str, sizeof(struct ObjString) + chars_sz, 0);
       break;
     }
+    case OBJ_ROPE:
+      reallocate(obj, sizeof(struct ObjRope), 0);
+      break;
   }
 }
 
-void free_objs()
+void free_objs(struct VM *vm)
 {
-  struct Obj *obj = vm.head_obj;
+  struct Obj *obj = vm->head_obj;
   while (obj != NULL)
   {
     struct Obj *next = obj->next;
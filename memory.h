@@ -3,6 +3,8 @@
 #include <stddef.h>
 
 void *reallocate(void *ptr, size_t old_sz, size_t new_sz);
-void free_objs();
+struct VM;
+
+void free_objs(struct VM *vm);
 
 #endif
@@ -0,0 +1,134 @@
+#include "number.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* every integer below this is exactly a double */
+#define EXACT_INTEGER_LIMIT 9007199254740992.0
+/* most digits the fixed point formatter tries after the point */
+#define FIXED_MAX_DECIMALS 15
+
+/* powers of ten that are exact doubles */
+static const double exact_powers[] =
+{
+  1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+/*
+ * clinger's fast path: when the digits fit a double exactly and the
+ * power of ten is exact too, a single multiply or divide is correctly
+ * rounded, which covers nearly every literal in real scripts. the rest
+ * (more than 15 significant digits, huge exponents) go to strtod.
+ */
+double parse_number(const char *start, int length)
+{
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int decimals = 0;
+  bool in_fraction = false;
+  for (int i = 0; i < length; i++)
+  {
+    char c = start[i];
+    if (c == '.')
+    {
+      in_fraction = true;
+      continue;
+    }
+    /* leading zeros don't count against the digit budget */
+    if (mantissa != 0 || c != '0')
+      digits++;
+    if (digits > 15)
+      return strtod(start, NULL);
+    mantissa = mantissa * 10 + (uint64_t)(c - '0');
+    if (in_fraction)
+      decimals++;
+  }
+
+  if (decimals > 22)
+    return strtod(start, NULL);
+  return (double)mantissa / exact_powers[decimals];
+}
+
+static int format_integer(uint64_t value, bool negative, char *buffer)
+{
+  char digits[24];
+  int count = 0;
+  do
+  {
+    digits[count++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+
+  int length = 0;
+  if (negative)
+    buffer[length++] = '-';
+  while (count > 0)
+    buffer[length++] = digits[--count];
+  buffer[length] = '\0';
+  return length;
+}
+
+/*
+ * integers print as integers. otherwise the fewest decimals d are found
+ * for which m / 10^d reads back as value, m being value * 10^d rounded:
+ * m and 10^d are both exact so the division is correctly rounded, and
+ * when it lands on value that decimal text round trips. values with too
+ * many digits for that fall back to %.15g, %.16g and %.17g, checked
+ * with strtod in that order.
+ */
+int format_number(double value, char *buffer)
+{
+  if (value != value)
+    return snprintf(buffer, NUMBER_MAX_LENGTH + 1, "%s", "nan");
+
+  bool negative = value < 0 || (value == 0 && 1 / value < 0);
+  double magnitude = negative ? -value : value;
+  if (magnitude < EXACT_INTEGER_LIMIT && magnitude == (double)(uint64_t)magnitude)
+    return format_integer((uint64_t)magnitude, negative, buffer);
+
+  for (int decimals = 1; decimals <= FIXED_MAX_DECIMALS; decimals++)
+  {
+    double scaled = magnitude * exact_powers[decimals];
+    if (scaled >= EXACT_INTEGER_LIMIT)
+      break;
+    uint64_t m = (uint64_t)(scaled + 0.5);
+    if ((double)m / exact_powers[decimals] != magnitude)
+      continue;
+
+    /* the digits of m with a point inserted, zero padded on the left */
+    char digits[24];
+    int count = format_integer(m, false, digits);
+    int length = 0;
+    if (negative)
+      buffer[length++] = '-';
+    if (count <= decimals)
+    {
+      buffer[length++] = '0';
+      buffer[length++] = '.';
+      for (int i = count; i < decimals; i++)
+        buffer[length++] = '0';
+      memcpy(buffer + length, digits, count);
+      length += count;
+    }
+    else
+    {
+      memcpy(buffer + length, digits, count - decimals);
+      length += count - decimals;
+      buffer[length++] = '.';
+      memcpy(buffer + length, digits + count - decimals, decimals);
+      length += decimals;
+    }
+    buffer[length] = '\0';
+    return length;
+  }
+
+  int length = 0;
+  for (int precision = 15; precision <= 17; precision++)
+  {
+    length = snprintf(buffer, NUMBER_MAX_LENGTH + 1, "%.*g", precision, value);
+    if (strtod(buffer, NULL) == value)
+      break;
+  }
+  return length;
+}
@@ -0,0 +1,17 @@
+#ifndef NUMBER_H_
+#define NUMBER_H_
+
+#include "common.h"
+
+/* longest text format_number writes, without the nul */
+#define NUMBER_MAX_LENGTH 32
+
+/* parses a literal as the scanner produces it, digits with an optional fraction */
+double parse_number(const char *start, int length);
+/*
+ * writes the shortest text that reads back as exactly value and
+ * returns its length, buffer needs NUMBER_MAX_LENGTH + 1 bytes
+ */
+int format_number(double value, char *buffer);
+
+#endif
@@ -1,65 +1,208 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "hash.h"
+#include "intern.h"
 #include "memory.h"
 #include "object.h"
 #include "value.h"
 #include "vm.h"
 
-static struct Obj *allocate_obj(size_t sz, enum ObjType type)
+static struct Obj *allocate_obj(struct VM *vm, size_t sz, enum ObjType type)
 {
   struct Obj *obj = (struct Obj *)reallocate(NULL, 0, sz);
   obj->type = type;
-  obj->next = vm.head_obj;
-  vm.head_obj = obj;
+  obj->next = vm->head_obj;
+  vm->head_obj = obj;
   return obj;
 }
 
-static struct ObjString *allocate_str(const char *c_str, int length, uint32_t hash)
+static struct ObjString *new_str(struct VM *vm, const char *c_str, int length)
 {
-  struct ObjString *string = (struct ObjString *)allocate_obj(sizeof(struct ObjString) +
+  struct ObjString *string = (struct ObjString *)allocate_obj(vm, sizeof(struct ObjString) +
                                                              (sizeof(char) * length + 1), OBJ_STRING);
-  string->hash = hash;
-  table_set(&vm.strings, string, NIL_VAL); 
+  string->hash = 0;
+  string->interned = false;
   string->length = length;
+  string->chars = string->c_str;
+  string->parent = NULL;
   memcpy(string->c_str, c_str, length);
   string->c_str[length] = '\0';
   return string;
 }
 
-static uint32_t hash_str(const char *key, int length)
+static struct ObjString *allocate_str(struct VM *vm, const char *c_str, int length, uint32_t hash)
 {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++)
-  {
-    hash ^= (uint8_t)key[i];
-    hash *= 16777619;
-  }
-  return hash;
+  struct ObjString *string = new_str(vm, c_str, length);
+  string->hash = hash;
+  string->interned = true;
+  table_set(&vm->strings, string, NIL_VAL); 
+  return string;
 }
 
-struct ObjString *take_str(char *c_str, int length)
+/*
+ * strings built at runtime start out un-interned and without a hash,
+ * most of them are printed or dropped without ever being compared so
+ * hashing them and probing vm->strings would be wasted work.
+ * values_equal() compares contents whenever an un-interned string is
+ * involved.
+ */
+struct ObjString *take_str(struct VM *vm, char *c_str, int length)
 {
-  uint32_t hash = hash_str(c_str, length);
-  struct ObjString *interned = table_find_str(&vm.strings, c_str, length, hash);
-  if (interned != NULL)
-  {
-    reallocate(c_str, sizeof(char) * (length + 1), 0);
-    return interned;
-  }
-  return allocate_str(c_str, length, hash);
+  struct ObjString *string = new_str(vm, c_str, length);
+  reallocate(c_str, sizeof(char) * (length + 1), 0);
+  return string;
 }
 
-struct ObjString *copy_str(const char *c_str, int length)
+struct ObjString *copy_str(struct VM *vm, const char *c_str, int length)
 {
 //  char *heap_chars = (char *)reallocate(NULL, 0, sizeof(char) * (length + 1));
 //  memcpy(heap_chars, c_str, length);
 //  heap_chars[length] = '\0';
-  uint32_t hash = hash_str(c_str, length);
-  struct ObjString *interned = table_find_str(&vm.strings, c_str, length, hash);
+  uint32_t hash = hash_bytes(c_str, length);
+  if (shared_strings_enabled())
+    return intern_shared(c_str, length, hash);
+  struct ObjString *interned = table_find_str(&vm->strings, c_str, length, hash);
   if (interned != NULL)
     return interned;
-  return allocate_str(c_str, length, hash);
+  return allocate_str(vm, c_str, length, hash);
+}
+
+struct ObjString *copy_runtime_str(struct VM *vm, const char *c_str, int length)
+{
+  return new_str(vm, c_str, length);
+}
+
+struct ObjString *find_str(struct VM *vm, const char *c_str, int length)
+{
+  uint32_t hash = hash_bytes(c_str, length);
+  if (shared_strings_enabled())
+    return find_shared(c_str, length, hash);
+  return table_find_str(&vm->strings, c_str, length, hash);
+}
+
+/*
+ * substrings share their parent's characters instead of copying them.
+ * there is no collector, a parent lives as long as its vm whether or
+ * not slices point into it, so a slice never pins memory that would
+ * otherwise have been freed
+ */
+struct ObjString *slice_str(struct VM *vm, struct ObjString *string, int offset, int length)
+{
+  if (length < SLICE_MIN_LENGTH)
+    return new_str(vm, string->chars + offset, length);
+
+  /* always point at the string that owns the characters */
+  if (string->parent != NULL)
+  {
+    offset += (int)(string->chars - string->parent->chars);
+    string = string->parent;
+  }
+  struct ObjString *slice = (struct ObjString *)allocate_obj(vm, sizeof(struct ObjString), OBJ_STRING);
+  slice->hash = 0;
+  slice->interned = false;
+  slice->length = length;
+  slice->chars = string->chars + offset;
+  slice->parent = string;
+  return slice;
+}
+
+/* a copy of a slice with characters of its own, anything else as is */
+struct ObjString *materialize_str(struct VM *vm, struct ObjString *string)
+{
+  if (string->parent == NULL)
+    return string;
+  return new_str(vm, string->chars, string->length);
+}
+
+int text_length(struct Obj *text)
+{
+  if (text->type == OBJ_ROPE)
+    return ((struct ObjRope *)text)->length;
+  return ((struct ObjString *)text)->length;
+}
+
+/* a rope that was already flattened stands in for its string */
+static struct Obj *rope_operand(struct Obj *text)
+{
+  if (text->type == OBJ_ROPE && ((struct ObjRope *)text)->flat != NULL)
+    return (struct Obj *)((struct ObjRope *)text)->flat;
+  return text;
+}
+
+struct ObjRope *new_rope(struct VM *vm, struct Obj *left, struct Obj *right)
+{
+  struct ObjRope *rope = (struct ObjRope *)allocate_obj(vm, sizeof(struct ObjRope), OBJ_ROPE);
+  rope->left = rope_operand(left);
+  rope->right = rope_operand(right);
+  rope->length = text_length(left) + text_length(right);
+  rope->flat = NULL;
+  return rope;
+}
+
+void copy_text(struct Obj *text, char *dest)
+{
+  /*
+   * the buffer is filled from the back. right children are popped
+   * first, so the pending stack stays short for the left-leaning
+   * ropes that s = s + piece builds
+   */
+  int stack_capacity = 64;
+  int stack_count = 0;
+  struct Obj **stack = (struct Obj **)reallocate(NULL, 0, sizeof(struct Obj *) * stack_capacity);
+  stack[stack_count++] = text;
+  int pos = text_length(text);
+  while (stack_count > 0)
+  {
+    struct Obj *node = rope_operand(stack[--stack_count]);
+    if (node->type == OBJ_STRING)
+    {
+      struct ObjString *str = (struct ObjString *)node;
+      pos -= str->length;
+      memcpy(dest + pos, str->chars, str->length);
+      continue;
+    }
+
+    if (stack_count + 2 > stack_capacity)
+    {
+      stack = (struct Obj **)reallocate(stack, sizeof(struct Obj *) * stack_capacity,
+                                        sizeof(struct Obj *) * stack_capacity * 2);
+      stack_capacity *= 2;
+    }
+    stack[stack_count++] = ((struct ObjRope *)node)->left;
+    stack[stack_count++] = ((struct ObjRope *)node)->right;
+  }
+  reallocate(stack, sizeof(struct Obj *) * stack_capacity, 0);
+}
+
+struct ObjString *flatten_rope(struct VM *vm, struct ObjRope *rope)
+{
+  if (rope->flat != NULL)
+    return rope->flat;
+
+  char *c_str = (char *)reallocate(NULL, 0, rope->length + 1);
+  copy_text((struct Obj *)rope, c_str);
+  c_str[rope->length] = '\0';
+  rope->flat = take_str(vm, c_str, rope->length);
+  return rope->flat;
+}
+
+/*
+ * copied out with copy_text() rather than walked recursively, a rope
+ * built by a long s = s + piece loop is as deep as the loop ran. there
+ * is no vm here to keep the flat copy in, so it is dropped after
+ */
+static void print_rope(struct ObjRope *rope)
+{
+  if (rope->flat != NULL)
+  {
+    printf("%.*s", rope->flat->length, rope->flat->chars);
+    return;
+  }
+  char *text = (char *)reallocate(NULL, 0, rope->length + 1);
+  copy_text((struct Obj *)rope, text);
+  fwrite(text, 1, rope->length, stdout);
+  reallocate(text, rope->length + 1, 0);
 }
 
 void print_obj(Value value, bool align)
@@ -68,8 +211,10 @@ void print_obj(Value value, bool align)
   {
     case OBJ_STRING:
       struct ObjString *obj_str = (struct ObjString *)AS_OBJ(value);
-      char *str = obj_str->c_str;
-      printf(align ? "%-16s" : "%s", str);
+      printf(align ? "%-16.*s" : "%.*s", obj_str->length, obj_str->chars);
+      break;
+    case OBJ_ROPE:
+      print_rope(AS_ROPE(value));
       break;
   }
 }
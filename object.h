@@ -7,13 +7,23 @@
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 
 #define IS_STRING(value) is_obj_type(value, OBJ_STRING)
+#define IS_ROPE(value) is_obj_type(value, OBJ_ROPE)
+/* anything with string contents, flat or not */
+#define IS_TEXT(value) (IS_STRING(value) || IS_ROPE(value))
 
 #define AS_STRING(value) ((struct ObjString *)AS_OBJ(value))
-#define AS_CSTRING(value) ((struct ObjString *)AS_OBJ(value))->c_str
+#define AS_CSTRING(value) ((struct ObjString *)AS_OBJ(value))->chars
+#define AS_ROPE(value) ((struct ObjRope *)AS_OBJ(value))
+
+/* concatenations shorter than this are copied right away */
+#define ROPE_MIN_LENGTH 64
+/* substrings shorter than this are copied, a slice would be no smaller */
+#define SLICE_MIN_LENGTH 16
 
 enum ObjType
 {
   OBJ_STRING,
+  OBJ_ROPE,
 };
 
 typedef struct Obj
@@ -26,12 +36,48 @@ struct ObjString
 {
   struct Obj obj;
   uint32_t hash;
+  /* only interned strings have a hash and live in a strings table */
+  bool interned;
   int length;
+  /*
+   * the characters, c_str for a string that owns them. a slice owns
+   * none and points into its parent instead, so its characters are
+   * not nul terminated
+   */
+  const char *chars;
+  struct ObjString *parent;
   char c_str[];
 };
 
-struct ObjString *take_str(char *c_str, int length);
-struct ObjString *copy_str(const char *c_str, int length);
+/*
+ * the lazy result of a concatenation, left and right are strings or
+ * other ropes. it is only turned into a real string, with a single
+ * allocation, once its characters are needed and that string is kept
+ * so it happens at most once.
+ */
+struct ObjRope
+{
+  struct Obj obj;
+  int length;
+  struct Obj *left;
+  struct Obj *right;
+  struct ObjString *flat;
+};
+
+struct VM;
+
+struct ObjString *take_str(struct VM *vm, char *c_str, int length);
+struct ObjString *copy_str(struct VM *vm, const char *c_str, int length);
+/* a copy that is never interned, for data rather than names */
+struct ObjString *copy_runtime_str(struct VM *vm, const char *c_str, int length);
+/* the interned string with these characters if there is one, never creates it */
+struct ObjString *find_str(struct VM *vm, const char *c_str, int length);
+struct ObjString *slice_str(struct VM *vm, struct ObjString *string, int offset, int length);
+struct ObjString *materialize_str(struct VM *vm, struct ObjString *string);
+struct ObjRope *new_rope(struct VM *vm, struct Obj *left, struct Obj *right);
+struct ObjString *flatten_rope(struct VM *vm, struct ObjRope *rope);
+int text_length(struct Obj *text);
+void copy_text(struct Obj *text, char *dest);
 void print_obj(Value value, bool align);
 
 static inline bool is_obj_type(Value value, enum ObjType type)
@@ -0,0 +1,145 @@
+#define _GNU_SOURCE
+#include "output.h"
+#include "memory.h"
+#include "number.h"
+#include "object.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+void init_output(struct Output *out, int fd)
+{
+  out->fd = fd;
+  out->line_buffered = isatty(fd);
+  out->data = NULL;
+  out->length = 0;
+}
+
+void free_output(struct Output *out)
+{
+  flush_output(out);
+  reallocate(out->data, out->data != NULL ? OUTPUT_BUFFER_SIZE : 0, 0);
+  out->data = NULL;
+}
+
+/* write(2) until everything is out, whatever can't be written is dropped */
+static void write_all(struct Output *out, struct iovec *iov, int count)
+{
+  /* anything stdio still holds for the same fd goes first */
+  if (out->fd == STDOUT_FILENO)
+    fflush(stdout);
+
+  while (count > 0)
+  {
+    ssize_t n = writev(out->fd, iov, count);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    while (count > 0 && (size_t)n >= iov->iov_len)
+    {
+      n -= (ssize_t)iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + n;
+      iov->iov_len -= (size_t)n;
+    }
+  }
+}
+
+void flush_output(struct Output *out)
+{
+  if (out->length == 0)
+    return;
+  struct iovec iov = {out->data, out->length};
+  write_all(out, &iov, 1);
+  out->length = 0;
+}
+
+/*
+ * a full buffer is written up to its last newline so that output from
+ * several VMs sharing an fd interleaves by whole lines, the partial line
+ * moves to the front
+ */
+static void flush_lines(struct Output *out)
+{
+  char *last = memrchr(out->data, '\n', out->length);
+  if (last == NULL)
+  {
+    flush_output(out);
+    return;
+  }
+  size_t lines = (size_t)(last - out->data) + 1;
+  struct iovec iov = {out->data, lines};
+  write_all(out, &iov, 1);
+  memmove(out->data, out->data + lines, out->length - lines);
+  out->length -= lines;
+}
+
+void write_output(struct Output *out, const char *bytes, size_t length)
+{
+  if (out->data == NULL)
+    out->data = (char *)reallocate(NULL, 0, OUTPUT_BUFFER_SIZE);
+
+  if (out->length + length > OUTPUT_BUFFER_SIZE)
+  {
+    /* too big to ever fit, goes out together with what is pending */
+    if (length >= OUTPUT_BUFFER_SIZE)
+    {
+      struct iovec iov[2] = {{out->data, out->length}, {(void *)bytes, length}};
+      write_all(out, iov, 2);
+      out->length = 0;
+      return;
+    }
+    flush_lines(out);
+    if (out->length + length > OUTPUT_BUFFER_SIZE)
+      flush_output(out);
+  }
+  memcpy(out->data + out->length, bytes, length);
+  out->length += length;
+}
+
+void write_value(struct Output *out, Value value)
+{
+  switch (value.type)
+  {
+    case VAL_BOOL:
+      if (AS_BOOL(value))
+        write_output(out, "true", 4);
+      else
+        write_output(out, "false", 5);
+      break;
+    case VAL_NIL:
+      write_output(out, "nil", 3);
+      break;
+    case VAL_NUMBER:
+    {
+      char buffer[NUMBER_MAX_LENGTH + 1];
+      int length = format_number(AS_NUMBER(value), buffer);
+      write_output(out, buffer, (size_t)length);
+      break;
+    }
+    case VAL_OBJ:
+    {
+      struct ObjString *string = AS_STRING(value);
+      write_output(out, string->chars, (size_t)string->length);
+      break;
+    }
+  }
+}
+
+void end_line(struct Output *out)
+{
+  write_output(out, "\n", 1);
+  if (out->line_buffered)
+    flush_output(out);
+}
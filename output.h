@@ -0,0 +1,29 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include "common.h"
+#include "value.h"
+
+/*
+ * what a VM prints goes through here instead of stdio. values are
+ * formatted straight into the buffer, which is written out with
+ * write(2) once it fills up, after every line when the fd is a
+ * terminal, and whenever the VM stops running or reports an error.
+ */
+struct Output
+{
+  int fd;
+  bool line_buffered;
+  char *data;
+  size_t length;
+};
+
+void init_output(struct Output *out, int fd);
+void free_output(struct Output *out);
+void write_output(struct Output *out, const char *bytes, size_t length);
+/* numbers, booleans, nil and flat strings, ropes must be flattened first */
+void write_value(struct Output *out, Value value);
+void end_line(struct Output *out);
+void flush_output(struct Output *out);
+
+#endif
@@ -0,0 +1,141 @@
+#include "profile.h"
+#include "disassem.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_TSC
+#define TSC_UNIT "cycles"
+#else
+#define TSC_UNIT "ns"
+#endif
+
+void init_profile(struct Profile *profile)
+{
+  memset(profile->opcodes, 0, sizeof(profile->opcodes));
+  profile->chunk = NULL;
+  profile->offsets = NULL;
+  profile->offset_count = 0;
+  profile->last_offset = -1;
+  profile->last_tsc = 0;
+}
+
+void free_profile(struct Profile *profile)
+{
+  reallocate(profile->offsets, sizeof(struct OffsetStats) * profile->offset_count, 0);
+  init_profile(profile);
+}
+
+/* running the same chunk again adds to its counts, a new one starts them over */
+void start_profile(struct Profile *profile, struct Chunk *chunk)
+{
+  profile->last_offset = -1;
+  if (chunk == profile->chunk && chunk->count == profile->offset_count)
+    return;
+  profile->chunk = chunk;
+  profile->offsets = (struct OffsetStats *)reallocate(profile->offsets,
+                                                      sizeof(struct OffsetStats) * profile->offset_count,
+                                                      sizeof(struct OffsetStats) * chunk->count);
+  profile->offset_count = chunk->count;
+  memset(profile->offsets, 0, sizeof(struct OffsetStats) * chunk->count);
+}
+
+void finish_profile(struct Profile *profile)
+{
+  if (profile->last_offset >= 0)
+  {
+    uint64_t cycles = read_tsc() - profile->last_tsc;
+    struct OffsetStats *last = &profile->offsets[profile->last_offset];
+    profile->opcodes[last->opcode].cycles += cycles;
+    last->cycles += cycles;
+    profile->last_offset = -1;
+  }
+
+  for (int offset = 0; offset < profile->offset_count; offset++)
+    if (profile->offsets[offset].count > 0)
+      profile->offsets[offset].line = get_line(profile->chunk, offset);
+}
+
+struct HotOpcode
+{
+  uint8_t opcode;
+  struct OpcodeStats stats;
+};
+
+struct HotOffset
+{
+  int offset;
+  struct OffsetStats stats;
+};
+
+/* most cycles first */
+static int compare_opcodes(const void *a, const void *b)
+{
+  uint64_t x = ((const struct HotOpcode *)a)->stats.cycles;
+  uint64_t y = ((const struct HotOpcode *)b)->stats.cycles;
+  return (x < y) - (x > y);
+}
+
+static int compare_offsets(const void *a, const void *b)
+{
+  uint64_t x = ((const struct HotOffset *)a)->stats.cycles;
+  uint64_t y = ((const struct HotOffset *)b)->stats.cycles;
+  return (x < y) - (x > y);
+}
+
+static double mean(uint64_t cycles, uint64_t count)
+{
+  return count == 0 ? 0 : (double)cycles / (double)count;
+}
+
+void print_profile(struct Profile *profile, FILE *file)
+{
+  struct HotOpcode opcodes[UINT8_COUNT];
+  int opcode_count = 0;
+  uint64_t total = 0;
+  for (int opcode = 0; opcode < UINT8_COUNT; opcode++)
+  {
+    if (profile->opcodes[opcode].count == 0)
+      continue;
+    opcodes[opcode_count].opcode = (uint8_t)opcode;
+    opcodes[opcode_count++].stats = profile->opcodes[opcode];
+    total += profile->opcodes[opcode].cycles;
+  }
+  qsort(opcodes, opcode_count, sizeof(struct HotOpcode), compare_opcodes);
+
+  fprintf(file, "%-22s %14s %16s %7s %10s\n", "opcode", "count", TSC_UNIT, "share", "mean");
+  for (int i = 0; i < opcode_count; i++)
+  {
+    struct OpcodeStats *stats = &opcodes[i].stats;
+    fprintf(file, "%-22s %14llu %16llu %6.1f%% %10.1f\n", opcode_name(opcodes[i].opcode),
+            (unsigned long long)stats->count, (unsigned long long)stats->cycles,
+            100.0 * mean(stats->cycles, total), mean(stats->cycles, stats->count));
+  }
+
+  int hot_count = 0;
+  for (int offset = 0; offset < profile->offset_count; offset++)
+    if (profile->offsets[offset].count > 0)
+      hot_count++;
+  struct HotOffset *hot = (struct HotOffset *)reallocate(NULL, 0, sizeof(struct HotOffset) * (hot_count + 1));
+  hot_count = 0;
+  for (int offset = 0; offset < profile->offset_count; offset++)
+  {
+    if (profile->offsets[offset].count == 0)
+      continue;
+    hot[hot_count].offset = offset;
+    hot[hot_count++].stats = profile->offsets[offset];
+  }
+  qsort(hot, hot_count, sizeof(struct HotOffset), compare_offsets);
+
+  fprintf(file, "\n%-8s %6s %-22s %14s %16s %7s %10s\n", "offset", "line", "opcode", "count",
+          TSC_UNIT, "share", "mean");
+  for (int i = 0; i < hot_count && i < PROFILE_HOT_OFFSETS; i++)
+  {
+    struct OffsetStats *stats = &hot[i].stats;
+    fprintf(file, "%04d     %6d %-22s %14llu %16llu %6.1f%% %10.1f\n", hot[i].offset, stats->line,
+            opcode_name(stats->opcode), (unsigned long long)stats->count,
+            (unsigned long long)stats->cycles, 100.0 * mean(stats->cycles, total),
+            mean(stats->cycles, stats->count));
+  }
+  reallocate(hot, sizeof(struct HotOffset) * (hot_count + 1), 0);
+}
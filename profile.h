@@ -0,0 +1,68 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdio.h>
+#include "chunk.h"
+#include "trace.h"
+
+/* bytecode offsets listed in the report */
+#define PROFILE_HOT_OFFSETS 20
+
+struct OpcodeStats
+{
+  uint64_t count;
+  uint64_t cycles;
+};
+
+struct OffsetStats
+{
+  uint64_t count;
+  uint64_t cycles;
+  /* filled in when the run ends, the chunk may be gone by the report */
+  int line;
+  uint8_t opcode;
+};
+
+/*
+ * how often each opcode and each instruction of the chunk last run
+ * executed, and the cycles from each instruction starting to the next
+ * one starting. that includes the dispatch and the profiler's own
+ * timestamp read, which is about the same for every instruction.
+ */
+struct Profile
+{
+  struct OpcodeStats opcodes[UINT8_COUNT];
+  struct Chunk *chunk;
+  struct OffsetStats *offsets;
+  int offset_count;
+  /* the instruction running now and when it started, -1 between runs */
+  int last_offset;
+  uint64_t last_tsc;
+};
+
+void init_profile(struct Profile *profile);
+void free_profile(struct Profile *profile);
+/* offsets are counted for chunk from here on */
+void start_profile(struct Profile *profile, struct Chunk *chunk);
+/* charges the last instruction of the run and looks up the lines of the offsets */
+void finish_profile(struct Profile *profile);
+void print_profile(struct Profile *profile, FILE *file);
+
+static inline void profile_instruction(struct Profile *profile, int offset, uint8_t opcode)
+{
+  uint64_t now = read_tsc();
+  if (profile->last_offset >= 0)
+  {
+    uint64_t cycles = now - profile->last_tsc;
+    struct OffsetStats *last = &profile->offsets[profile->last_offset];
+    profile->opcodes[last->opcode].cycles += cycles;
+    last->cycles += cycles;
+  }
+  profile->opcodes[opcode].count++;
+  profile->offsets[offset].count++;
+  profile->offsets[offset].opcode = opcode;
+  profile->last_offset = offset;
+  profile->last_tsc = now;
+}
+
+#endif
@@ -0,0 +1,184 @@
+#include "sample.h"
+#include "disassem.h"
+#include "memory.h"
+#include "vm.h"
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/* the timer only interrupts the thread that started it */
+static __thread struct Sampler *volatile sampling;
+
+/*
+ * the dispatch loop publishes vm->ip past the opcode with an atomic
+ * store before every instruction, so ip minus one is a byte of the
+ * instruction running. between an instruction ending and the next
+ * dispatch it is the last byte of the previous one, near enough.
+ */
+static void on_sample(int signal)
+{
+  (void)signal;
+  struct Sampler *sampler = sampling;
+  if (sampler == NULL)
+    return;
+  struct Chunk *chunk = sampler->chunk;
+  if (chunk == NULL)
+  {
+    sampler->outside++;
+    return;
+  }
+  uint8_t *ip = __atomic_load_n(&sampler->vm->ip, __ATOMIC_RELAXED);
+  ptrdiff_t offset = ip - chunk->code - 1;
+  if (offset < 0)
+    offset = 0;
+  if (offset < chunk->count)
+    sampler->counts[offset]++;
+  else
+    sampler->outside++;
+}
+
+void init_sampler(struct Sampler *sampler, const char *name)
+{
+  sampler->name = name;
+  sampler->vm = NULL;
+  sampler->chunk = NULL;
+  sampler->counts = NULL;
+  sampler->count_capacity = 0;
+  sampler->outside = 0;
+  sampler->lines = NULL;
+  sampler->line_count = 0;
+  sampler->line_capacity = 0;
+}
+
+void free_sampler(struct Sampler *sampler)
+{
+  reallocate(sampler->counts, sizeof(uint64_t) * sampler->count_capacity, 0);
+  reallocate(sampler->lines, sizeof(struct SampleLine) * sampler->line_capacity, 0);
+  init_sampler(sampler, NULL);
+}
+
+bool start_sampler(struct Sampler *sampler)
+{
+  struct sigaction action;
+  action.sa_handler = on_sample;
+  sigemptyset(&action.sa_mask);
+  /* reads from the repl and writes of print go on as if nothing happened */
+  action.sa_flags = SA_RESTART;
+  if (sigaction(SIGPROF, &action, NULL) != 0)
+    return false;
+
+  struct sigevent event;
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &sampler->timer) != 0)
+    return false;
+
+  sampling = sampler;
+  struct itimerspec interval;
+  interval.it_interval.tv_sec = 0;
+  interval.it_interval.tv_nsec = SAMPLE_INTERVAL * 1000L;
+  interval.it_value = interval.it_interval;
+  if (timer_settime(sampler->timer, 0, &interval, NULL) != 0)
+  {
+    sampling = NULL;
+    timer_delete(sampler->timer);
+    return false;
+  }
+  return true;
+}
+
+/* the handler stays, a SIGPROF still pending would kill the process otherwise */
+void stop_sampler(struct Sampler *sampler)
+{
+  timer_delete(sampler->timer);
+  if (sampling == sampler)
+    sampling = NULL;
+}
+
+void begin_samples(struct Sampler *sampler, struct VM *vm, struct Chunk *chunk)
+{
+  if (sampler->count_capacity < chunk->count)
+  {
+    sampler->counts = (uint64_t *)reallocate(sampler->counts, sizeof(uint64_t) * sampler->count_capacity,
+                                             sizeof(uint64_t) * chunk->count);
+    sampler->count_capacity = chunk->count;
+  }
+  memset(sampler->counts, 0, sizeof(uint64_t) * chunk->count);
+  sampler->vm = vm;
+  /* the handler must not see the chunk before the counts are ready */
+  atomic_signal_fence(memory_order_seq_cst);
+  sampler->chunk = chunk;
+}
+
+static void add_line(struct Sampler *sampler, int line, uint8_t opcode, uint64_t count)
+{
+  if (sampler->line_count == sampler->line_capacity)
+  {
+    int capacity = sampler->line_capacity < 8 ? 8 : sampler->line_capacity * 2;
+    sampler->lines = (struct SampleLine *)reallocate(sampler->lines,
+                                                     sizeof(struct SampleLine) * sampler->line_capacity,
+                                                     sizeof(struct SampleLine) * capacity);
+    sampler->line_capacity = capacity;
+  }
+  struct SampleLine *sample = &sampler->lines[sampler->line_count++];
+  sample->line = line;
+  sample->opcode = opcode;
+  sample->count = count;
+}
+
+/* charges the bytes sampled to the instructions they belong to */
+void end_samples(struct Sampler *sampler)
+{
+  struct Chunk *chunk = sampler->chunk;
+  sampler->chunk = NULL;
+  atomic_signal_fence(memory_order_seq_cst);
+
+  for (int offset = 0; offset < chunk->count;)
+  {
+    int length = instruction_length(chunk, offset);
+    uint64_t count = 0;
+    for (int byte = offset; byte < offset + length && byte < chunk->count; byte++)
+      count += sampler->counts[byte];
+    if (count > 0)
+      add_line(sampler, get_line(chunk, offset), chunk->code[offset], count);
+    offset += length;
+  }
+}
+
+static int compare_lines(const void *a, const void *b)
+{
+  const struct SampleLine *x = (const struct SampleLine *)a;
+  const struct SampleLine *y = (const struct SampleLine *)b;
+  if (x->line != y->line)
+    return (x->line > y->line) - (x->line < y->line);
+  return (x->opcode > y->opcode) - (x->opcode < y->opcode);
+}
+
+bool write_samples(struct Sampler *sampler, FILE *file)
+{
+  /* every run adds its own lines, the same instruction on a line is merged here */
+  qsort(sampler->lines, sampler->line_count, sizeof(struct SampleLine), compare_lines);
+  bool ok = true;
+  for (int i = 0; i < sampler->line_count;)
+  {
+    struct SampleLine *sample = &sampler->lines[i];
+    uint64_t count = 0;
+    for (; i < sampler->line_count && compare_lines(sample, &sampler->lines[i]) == 0; i++)
+      count += sampler->lines[i].count;
+    ok &= fprintf(file, "%s;%s:%d;%s %llu\n", sampler->name, sampler->name, sample->line,
+                  opcode_name(sample->opcode), (unsigned long long)count) > 0;
+  }
+  if (sampler->outside > 0)
+    ok &= fprintf(file, "%s;(outside bytecode) %llu\n", sampler->name,
+                  (unsigned long long)sampler->outside) > 0;
+  return ok;
+}
@@ -0,0 +1,56 @@
+#ifndef SAMPLE_H_
+#define SAMPLE_H_
+
+#include <stdio.h>
+#include <time.h>
+#include "chunk.h"
+
+/* microseconds of cpu time between samples, the kernel rounds it up to its tick */
+#define SAMPLE_INTERVAL 1000
+
+struct VM;
+
+/* samples that landed on one instruction of one source line */
+struct SampleLine
+{
+  int line;
+  uint8_t opcode;
+  uint64_t count;
+};
+
+/*
+ * a statistical profile. a timer on the cpu time of the thread that
+ * started it sends that thread SIGPROF every SAMPLE_INTERVAL, and the
+ * handler counts the byte of the ip the dispatch loop last published.
+ * nothing is added to the loop for it. the counts are folded into
+ * lines when the chunk finishes since it is freed right after.
+ */
+struct Sampler
+{
+  /* frame the folded stacks start with, the script name */
+  const char *name;
+  struct VM *vm;
+  /* the chunk running and samples per byte of it, NULL between runs */
+  struct Chunk *volatile chunk;
+  uint64_t *counts;
+  int count_capacity;
+  /* samples taken while no bytecode ran, compiling and startup mostly */
+  volatile uint64_t outside;
+  struct SampleLine *lines;
+  int line_count;
+  int line_capacity;
+  timer_t timer;
+};
+
+void init_sampler(struct Sampler *sampler, const char *name);
+void free_sampler(struct Sampler *sampler);
+/* samples the calling thread only, other threads are neither counted nor interrupted */
+bool start_sampler(struct Sampler *sampler);
+void stop_sampler(struct Sampler *sampler);
+/* samples are charged to chunk running on vm from here on */
+void begin_samples(struct Sampler *sampler, struct VM *vm, struct Chunk *chunk);
+void end_samples(struct Sampler *sampler);
+/* one "name;name:line;opcode count" line per instruction sampled, as flame graph tools read */
+bool write_samples(struct Sampler *sampler, FILE *file);
+
+#endif
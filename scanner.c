@@ -1,21 +1,17 @@
 #include "scanner.h"
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
-struct Scanner
+void init_scanner(struct Scanner *scanner, const char *src, size_t length)
 {
-  const char *start;
-  const char *curr;
-  int line;
-};
-
-struct Scanner scanner;
-
-void init_scanner(const char *src)
-{
-  scanner.start = src;
-  scanner.curr = src;
-  scanner.line = 1;
+  scanner->start = src;
+  scanner->curr = src;
+  scanner->end = src + length;
+  scanner->line = 1;
 }
 
 static bool is_alpha(char c)
@@ -30,219 +26,321 @@ static bool is_digit(char c)
   return c >= '0' && c <= '9';
 }
 
-static bool is_at_end()
+static bool is_at_end(struct Scanner *scanner)
 {
-  return *scanner.curr == '\0';
+  return *scanner->curr == '\0';
 }
 
-static char advance()
+static char advance(struct Scanner *scanner)
 {
-  return *scanner.curr++;
+  return *scanner->curr++;
 }
 
-static char peek()
+static char peek(struct Scanner *scanner)
 {
-  return *scanner.curr;
+  return *scanner->curr;
 }
 
-static char peek_next()
+static char peek_next(struct Scanner *scanner)
 {
-  if (is_at_end()) return '\0';
-  return scanner.curr[1];
+  if (is_at_end(scanner)) return '\0';
+  return scanner->curr[1];
 }
 
-static bool match(char expected)
+static bool match(struct Scanner *scanner, char expected)
 {
-  if (is_at_end())
+  if (is_at_end(scanner))
     return false;
-  if (*scanner.curr != expected)
+  if (*scanner->curr != expected)
     return false;
-  scanner.curr++;
+  scanner->curr++;
   return true;
 }
 
-static struct Token make_token(enum TokenType type)
+static struct Token make_token(struct Scanner *scanner, enum TokenType type)
 {
   struct Token token;
   token.type = type;
-  token.start = scanner.start;
-  token.length = (int)(scanner.curr - scanner.start);
-  token.line = scanner.line;
+  token.start = scanner->start;
+  token.length = (int)(scanner->curr - scanner->start);
+  token.line = scanner->line;
   return token;
 }
 
-static struct Token err_token(const char *msg)
+static struct Token err_token(struct Scanner *scanner, const char *msg)
 {
   struct Token token;
   token.type = TOKEN_ERROR;
   token.start = msg;
   token.length = (int)strlen(msg);
-  token.line = scanner.line;
+  token.line = scanner->line;
   return token;
 }
 
-static void skip_whitespace()
+/*
+ * runs of whitespace, identifier characters, digits and string bodies
+ * are skipped a block at a time: each byte of the block is classified
+ * with vector compares, the movemask of the bytes that end the run
+ * gives its length and a popcount of the newlines before that point
+ * keeps the line number right. the block width is picked at compile
+ * time because these runs are short and a dispatched call per token
+ * would cost more than it saves. the last partial block and builds
+ * without SSE2 go through the byte loop.
+ */
+enum CharClass
 {
-  for (;;)
+  CLASS_BLANK,
+  CLASS_IDENTIFIER,
+  CLASS_DIGIT,
+  CLASS_STRING_BODY
+};
+
+static inline bool in_class(char c, enum CharClass class)
+{
+  switch (class)
+  {
+    case CLASS_BLANK:       return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+    case CLASS_IDENTIFIER:  return is_alpha(c) || is_digit(c);
+    case CLASS_DIGIT:       return is_digit(c);
+    case CLASS_STRING_BODY: return c != '"';
+  }
+  return false;
+}
+
+#if defined(__AVX2__)
+#define BLOCK_WIDTH 32
+#define BLOCK_MASK 0xffffffffu
+typedef __m256i Block;
+static inline Block load_block(const char *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline Block splat(char c) { return _mm256_set1_epi8(c); }
+static inline Block block_eq(Block a, Block b) { return _mm256_cmpeq_epi8(a, b); }
+static inline Block block_gt(Block a, Block b) { return _mm256_cmpgt_epi8(a, b); }
+static inline Block block_or(Block a, Block b) { return _mm256_or_si256(a, b); }
+static inline Block block_and(Block a, Block b) { return _mm256_and_si256(a, b); }
+static inline uint32_t block_bits(Block a) { return (uint32_t)_mm256_movemask_epi8(a); }
+#elif defined(__SSE2__)
+#define BLOCK_WIDTH 16
+#define BLOCK_MASK 0xffffu
+typedef __m128i Block;
+static inline Block load_block(const char *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline Block splat(char c) { return _mm_set1_epi8(c); }
+static inline Block block_eq(Block a, Block b) { return _mm_cmpeq_epi8(a, b); }
+static inline Block block_gt(Block a, Block b) { return _mm_cmpgt_epi8(a, b); }
+static inline Block block_or(Block a, Block b) { return _mm_or_si128(a, b); }
+static inline Block block_and(Block a, Block b) { return _mm_and_si128(a, b); }
+static inline uint32_t block_bits(Block a) { return (uint32_t)_mm_movemask_epi8(a); }
+#endif
+
+#ifdef BLOCK_WIDTH
+/* signed compares, so bytes from 0x80 up are never in range */
+static inline Block block_in_range(Block v, char low, char high)
+{
+  return block_and(block_gt(v, splat((char)(low - 1))), block_gt(splat((char)(high + 1)), v));
+}
+
+/* bit i set when byte i of the block is in the class */
+static inline uint32_t class_bits(Block v, enum CharClass class)
+{
+  switch (class)
   {
-    char c = peek();
-    switch (c)
+    case CLASS_BLANK:
+      return block_bits(block_or(block_or(block_eq(v, splat(' ')), block_eq(v, splat('\t'))),
+                                 block_or(block_eq(v, splat('\r')), block_eq(v, splat('\n')))));
+    case CLASS_IDENTIFIER:
+      /* setting bit 5 folds upper case onto lower case */
+      return block_bits(block_or(block_or(block_in_range(block_or(v, splat(0x20)), 'a', 'z'),
+                                          block_in_range(v, '0', '9')),
+                                 block_eq(v, splat('_'))));
+    case CLASS_DIGIT:
+      return block_bits(block_in_range(v, '0', '9'));
+    case CLASS_STRING_BODY:
+      return ~block_bits(block_eq(v, splat('"'))) & BLOCK_MASK;
+  }
+  return 0;
+}
+#endif
+
+/* newlines are rare enough that a popcount only runs when there are some */
+static inline int count_bits(uint32_t bits)
+{
+  return bits == 0 ? 0 : __builtin_popcount(bits);
+}
+
+/* the end of the run of class characters starting at p */
+static inline __attribute__((always_inline))
+const char *skip_run(struct Scanner *scanner, const char *p, enum CharClass class)
+{
+  const bool has_newlines = class == CLASS_BLANK || class == CLASS_STRING_BODY;
+  /*
+   * most runs between tokens are empty or a single space, loading a
+   * block for those is slower than looking at a byte or two
+   */
+  if (p < scanner->end && !in_class(*p, class))
+    return p;
+  if (class == CLASS_BLANK && *p == ' ' && p + 1 < scanner->end && !in_class(p[1], class))
+    return p + 1;
+#ifdef BLOCK_WIDTH
+  while (scanner->end - p >= BLOCK_WIDTH)
+  {
+    Block v = load_block(p);
+    uint32_t stop = ~class_bits(v, class) & BLOCK_MASK;
+    uint32_t newlines = has_newlines ? block_bits(block_eq(v, splat('\n'))) : 0;
+    if (stop != 0)
     {
-      case ' ':
-      case '\r':
-      case '\t':
-        advance();
-        break;
-      case '\n':
-        scanner.line++;
-        advance();
-        break;
-      case '/':
-        if (peek_next() == '/')
-          while (peek() != '\n' && !is_at_end())
-            advance();
-        else
-          return;
-        break;
-      default:
-        return;
+      scanner->line += count_bits(newlines & ((stop & -stop) - 1));
+      return p + __builtin_ctz(stop);
     }
+    scanner->line += count_bits(newlines);
+    p += BLOCK_WIDTH;
+  }
+#endif
+  while (p < scanner->end && in_class(*p, class))
+  {
+    if (has_newlines && *p == '\n')
+      scanner->line++;
+    p++;
   }
+  return p;
 }
 
-static enum TokenType check_keyword(int start, int length,
+static void skip_whitespace(struct Scanner *scanner)
+{
+  for (;;)
+  {
+    scanner->curr = skip_run(scanner, scanner->curr, CLASS_BLANK);
+    if (peek(scanner) != '/' || peek_next(scanner) != '/')
+      return;
+    /* the newline ending the comment is counted with the next run */
+    const char *newline = memchr(scanner->curr, '\n', scanner->end - scanner->curr);
+    scanner->curr = newline != NULL ? newline : scanner->end;
+  }
+}
+
+static enum TokenType check_keyword(struct Scanner *scanner, int start, int length,
                 const char* rest, enum TokenType type)
 {
-  if (scanner.curr - scanner.start == start + length &&
-      memcmp(scanner.start + start, rest, length) == 0) {
+  if (scanner->curr - scanner->start == start + length &&
+      memcmp(scanner->start + start, rest, length) == 0) {
     return type;
   }
 
   return TOKEN_IDENTIFIER;
 }
 
-static struct Token number()
+static struct Token number(struct Scanner *scanner)
 {
-  while (is_digit(peek()))
-    advance();
-  if (peek() == '.' && is_digit(peek_next()))
+  scanner->curr = skip_run(scanner, scanner->curr, CLASS_DIGIT);
+  if (peek(scanner) == '.' && is_digit(peek_next(scanner)))
   {
-    advance();
-    while (is_digit(peek()))
-      advance();
+    advance(scanner);
+    scanner->curr = skip_run(scanner, scanner->curr, CLASS_DIGIT);
   }
-  return make_token(TOKEN_NUMBER);
+  return make_token(scanner, TOKEN_NUMBER);
 }
 
-static struct Token string()
+static struct Token string(struct Scanner *scanner)
 {
-  while (peek() != '"' && !is_at_end())
-  {
-    if (peek() == '\n')
-      scanner.line++;
-    advance();
-  }
+  scanner->curr = skip_run(scanner, scanner->curr, CLASS_STRING_BODY);
 
-  if (is_at_end())
-    return err_token("Unterminated string.");
+  if (is_at_end(scanner))
+    return err_token(scanner, "Unterminated string.");
 
-  advance();
-  return make_token(TOKEN_STRING);
+  advance(scanner);
+  return make_token(scanner, TOKEN_STRING);
 }
 
-static enum TokenType identifier_type()
+static enum TokenType identifier_type(struct Scanner *scanner)
 {
-  switch (*scanner.start)
+  switch (*scanner->start)
   {
-    case 'a': return check_keyword(1, 2, "nd", TOKEN_AND);
-    case 'b': return check_keyword(1, 4, "reak", TOKEN_BREAK);
+    case 'a': return check_keyword(scanner, 1, 2, "nd", TOKEN_AND);
+    case 'b': return check_keyword(scanner, 1, 4, "reak", TOKEN_BREAK);
     case 'c':
-      if (scanner.curr - scanner.start > 1)
+      if (scanner->curr - scanner->start > 1)
       {
-        switch (*(scanner.start + 1))
+        switch (*(scanner->start + 1))
         {
-          case 'l': return check_keyword(2, 3, "ass", TOKEN_CLASS);
-          case 'o': return check_keyword(2, 6, "ntinue", TOKEN_CONTINUE);
+          case 'l': return check_keyword(scanner, 2, 3, "ass", TOKEN_CLASS);
+          case 'o': return check_keyword(scanner, 2, 6, "ntinue", TOKEN_CONTINUE);
         }
       }
       break;
-    case 'e': return check_keyword(1, 3, "lse", TOKEN_ELSE);
+    case 'e': return check_keyword(scanner, 1, 3, "lse", TOKEN_ELSE);
     case 'f':
-      if (scanner.curr - scanner.start > 1)
+      if (scanner->curr - scanner->start > 1)
       {
-        switch (*(scanner.start + 1))
+        switch (*(scanner->start + 1))
         {
-          case 'a': return check_keyword(2, 3, "lse", TOKEN_FALSE);
-          case 'o': return check_keyword(2, 1, "r", TOKEN_FOR);
-          case 'u': return check_keyword(2, 1, "n", TOKEN_FUN);
+          case 'a': return check_keyword(scanner, 2, 3, "lse", TOKEN_FALSE);
+          case 'o': return check_keyword(scanner, 2, 1, "r", TOKEN_FOR);
+          case 'u': return check_keyword(scanner, 2, 1, "n", TOKEN_FUN);
         }
       }
       break;
-    case 'i': return check_keyword(1, 1, "f", TOKEN_IF);
-    case 'n': return check_keyword(1, 2, "il", TOKEN_NIL);
-    case 'o': return check_keyword(1, 1, "r", TOKEN_OR);
-    case 'p': return check_keyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r': return check_keyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's': return check_keyword(1, 4, "uper", TOKEN_SUPER);
+    case 'i': return check_keyword(scanner, 1, 1, "f", TOKEN_IF);
+    case 'n': return check_keyword(scanner, 1, 2, "il", TOKEN_NIL);
+    case 'o': return check_keyword(scanner, 1, 1, "r", TOKEN_OR);
+    case 'p': return check_keyword(scanner, 1, 4, "rint", TOKEN_PRINT);
+    case 'r': return check_keyword(scanner, 1, 5, "eturn", TOKEN_RETURN);
+    case 's': return check_keyword(scanner, 1, 4, "uper", TOKEN_SUPER);
     case 't':
-      if (scanner.curr - scanner.start > 1)
+      if (scanner->curr - scanner->start > 1)
       {
-        switch (*(scanner.start + 1))
+        switch (*(scanner->start + 1))
         {
-          case 'h': return check_keyword(2, 2, "is", TOKEN_THIS);
-          case 'r': return check_keyword(2, 2, "ue", TOKEN_TRUE);
+          case 'h': return check_keyword(scanner, 2, 2, "is", TOKEN_THIS);
+          case 'r': return check_keyword(scanner, 2, 2, "ue", TOKEN_TRUE);
         }
       }
       break;
-    case 'v': return check_keyword(1, 2, "ar", TOKEN_VAR);
-    case 'w': return check_keyword(1, 4, "hile", TOKEN_WHILE);
+    case 'v': return check_keyword(scanner, 1, 2, "ar", TOKEN_VAR);
+    case 'w': return check_keyword(scanner, 1, 4, "hile", TOKEN_WHILE);
   }
   return TOKEN_IDENTIFIER;
 }
 
-static struct Token identifier()
+static struct Token identifier(struct Scanner *scanner)
 {
-  while (is_alpha(peek()) || is_digit(peek()))
-    advance();
-  return make_token(identifier_type());
+  scanner->curr = skip_run(scanner, scanner->curr, CLASS_IDENTIFIER);
+  return make_token(scanner, identifier_type(scanner));
 }
 
 
 
-struct Token scan_token()
+struct Token scan_token(struct Scanner *scanner)
 {
-  skip_whitespace();
-  scanner.start = scanner.curr;
-  if (is_at_end())
-    return make_token(TOKEN_EOF);
-  char c = advance();
+  skip_whitespace(scanner);
+  scanner->start = scanner->curr;
+  if (is_at_end(scanner))
+    return make_token(scanner, TOKEN_EOF);
+  char c = advance(scanner);
   if (is_alpha(c))
-    return identifier();
+    return identifier(scanner);
   if (is_digit(c))
-    return number();
+    return number(scanner);
   switch (c)
   {
-    case '(': return make_token(TOKEN_LEFT_PAREN);
-    case ')': return make_token(TOKEN_RIGHT_PAREN);
-    case '{': return make_token(TOKEN_LEFT_BRACE);
-    case '}': return make_token(TOKEN_RIGHT_BRACE);
-    case ';': return make_token(TOKEN_SEMICOLON);
-    case ',': return make_token(TOKEN_COMMA);
-    case '.': return make_token(TOKEN_DOT);
-    case '-': return make_token(TOKEN_MINUS);
-    case '+': return make_token(TOKEN_PLUS);
-    case '/': return make_token(TOKEN_SLASH);
-    case '*': return make_token(TOKEN_STAR);
+    case '(': return make_token(scanner, TOKEN_LEFT_PAREN);
+    case ')': return make_token(scanner, TOKEN_RIGHT_PAREN);
+    case '{': return make_token(scanner, TOKEN_LEFT_BRACE);
+    case '}': return make_token(scanner, TOKEN_RIGHT_BRACE);
+    case ';': return make_token(scanner, TOKEN_SEMICOLON);
+    case ',': return make_token(scanner, TOKEN_COMMA);
+    case '.': return make_token(scanner, TOKEN_DOT);
+    case '-': return make_token(scanner, TOKEN_MINUS);
+    case '+': return make_token(scanner, TOKEN_PLUS);
+    case '/': return make_token(scanner, TOKEN_SLASH);
+    case '*': return make_token(scanner, TOKEN_STAR);
     case '!':
-        return make_token(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
     case '=':
-        return make_token(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     case '<':
-        return make_token(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     case '>':
-        return make_token(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
+        return make_token(scanner, match(scanner, '=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
     case '"':
-        return string();
+        return string(scanner);
   }
-  return err_token("Unexpected character.");
+  return err_token(scanner, "Unexpected character.");
 }
@@ -1,6 +1,8 @@
 #ifndef SCANNER_H_
 #define SCANNER_H_
 
+#include <stddef.h>
+
 enum TokenType
 {
   // Single-character tokens.
@@ -32,7 +34,17 @@ struct Token
   int line;
 };
 
-void init_scanner(const char *src);
-struct Token scan_token();
+struct Scanner
+{
+  const char *start;
+  const char *curr;
+  /* the terminating nul, src + length, block reads never go past it */
+  const char *end;
+  int line;
+};
+
+/* src is length bytes followed by a nul */
+void init_scanner(struct Scanner *scanner, const char *src, size_t length);
+struct Token scan_token(struct Scanner *scanner);
 
 #endif
@@ -0,0 +1,359 @@
+#include "server.h"
+#include "cscript.h"
+#include "memory.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * fork server mode
+ *
+ * the server sets up the vm, compiles the script and runs the prelude
+ * once. every request then gets its own forked child which inherits the
+ * warm heap and the compiled chunk copy-on-write, sets the global
+ * 'input' to the request line and runs the script. the server captures
+ * everything the child writes to stdout and stderr, waits for its exit
+ * code and reports how long the request took.
+ */
+
+struct Response
+{
+  char *output;
+  size_t length;
+  size_t capacity;
+  int status;
+  double latency;
+};
+
+static double now_sec()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void append_output(struct Response *res, const char *bytes, size_t length)
+{
+  if (res->capacity < res->length + length)
+  {
+    size_t capacity = res->capacity < 256 ? 256 : res->capacity;
+    while (capacity < res->length + length)
+      capacity *= 2;
+    res->output = (char *)reallocate(res->output, res->capacity, capacity);
+    res->capacity = capacity;
+  }
+  memcpy(res->output + res->length, bytes, length);
+  res->length += length;
+}
+
+static void run_child(struct VM *vm, struct Script *script, const char *input, int out_fd)
+{
+  dup2(out_fd, STDOUT_FILENO);
+  dup2(out_fd, STDERR_FILENO);
+  close(out_fd);
+
+  cs_set_global(vm, "input", cs_string(vm, input));
+  enum InterpretResult result = cs_run(vm, script);
+  fflush(stdout);
+  fflush(stderr);
+  _exit(result == INTERPRET_OK ? 0 : result == INTERPRET_COMPILE_ERR ? 65 : 70);
+}
+
+static bool handle_request(struct VM *vm, struct Script *script, const char *input,
+                           struct Response *res)
+{
+  int fds[2];
+  if (pipe(fds) != 0)
+    return false;
+
+  res->length = 0;
+  double start = now_sec();
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0)
+  {
+    close(fds[0]);
+    run_child(vm, script, input, fds[1]);
+  }
+
+  close(fds[1]);
+  char buffer[4096];
+  for (;;)
+  {
+    ssize_t n = read(fds[0], buffer, sizeof(buffer));
+    if (n > 0)
+      append_output(res, buffer, n);
+    else if (n == 0 || errno != EINTR)
+      break;
+  }
+  close(fds[0]);
+
+  int status;
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  res->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  res->latency = now_sec() - start;
+  return true;
+}
+
+static void report(int job, struct Response *res)
+{
+  fprintf(stderr, "server: request %d exit %d, %zu bytes, %.1fus\n",
+          job, res->status, res->length, res->latency * 1e6);
+}
+
+static void serve_stdin(struct VM *vm, struct Script *script)
+{
+  struct Response res = {NULL, 0, 0, 0, 0};
+  char *line = NULL;
+  size_t line_cap = 0;
+  ssize_t length;
+  for (int job = 0; (length = getline(&line, &line_cap, stdin)) >= 0; job++)
+  {
+    if (length > 0 && line[length - 1] == '\n')
+      line[length - 1] = '\0';
+    if (!handle_request(vm, script, line, &res))
+    {
+      fprintf(stderr, "server: could not fork for request %d\n", job);
+      continue;
+    }
+    fwrite(res.output, 1, res.length, stdout);
+    fflush(stdout);
+    report(job, &res);
+  }
+  free(line);
+  reallocate(res.output, res.capacity, 0);
+}
+
+/* what was read from a client past the request line, kept for the next one */
+struct Reader
+{
+  int fd;
+  char buffer[4096];
+  size_t start;
+  size_t end;
+};
+
+static void init_reader(struct Reader *reader, int fd)
+{
+  reader->fd = fd;
+  reader->start = 0;
+  reader->end = 0;
+}
+
+/* reads one request line from a client, the line ends at '\n' or eof */
+static char *read_request(struct Reader *reader)
+{
+  size_t length = 0, capacity = 256;
+  char *line = (char *)reallocate(NULL, 0, capacity);
+  for (;;)
+  {
+    if (reader->start == reader->end)
+    {
+      ssize_t n = read(reader->fd, reader->buffer, sizeof(reader->buffer));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      reader->start = 0;
+      reader->end = (size_t)n;
+    }
+
+    char *from = reader->buffer + reader->start;
+    size_t available = reader->end - reader->start;
+    char *newline = memchr(from, '\n', available);
+    size_t take = newline != NULL ? (size_t)(newline - from) : available;
+    if (length + take + 1 > capacity)
+    {
+      size_t grown = capacity;
+      while (length + take + 1 > grown)
+        grown *= 2;
+      line = (char *)reallocate(line, capacity, grown);
+      capacity = grown;
+    }
+    memcpy(line + length, from, take);
+    length += take;
+    reader->start += take;
+    if (newline != NULL)
+    {
+      reader->start++;
+      break;
+    }
+  }
+  line[length] = '\0';
+  return line;
+}
+
+static void write_all(int fd, const char *bytes, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t n = write(fd, bytes, length);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return;
+    bytes += n;
+    length -= n;
+  }
+}
+
+/*
+ * a client sends one request line and gets the output back followed
+ * by a final "exit <code>" line, then the connection is closed. runs
+ * in a child of its own so a slow client or a long request only holds
+ * up itself.
+ */
+static void serve_client(struct VM *vm, struct Script *script, int client, int job)
+{
+  signal(SIGCHLD, SIG_DFL);
+  struct Response res = {NULL, 0, 0, 0, 0};
+  struct Reader reader;
+  init_reader(&reader, client);
+  char *input = read_request(&reader);
+  if (handle_request(vm, script, input, &res))
+  {
+    char status[32];
+    int n = snprintf(status, sizeof(status), "exit %d\n", res.status);
+    write_all(client, res.output, res.length);
+    write_all(client, status, n);
+    report(job, &res);
+  }
+  else
+    fprintf(stderr, "server: could not fork for request %d\n", job);
+  close(client);
+  fflush(stderr);
+  _exit(0);
+}
+
+/* only there so a child exiting interrupts accept() and gets reaped */
+static void on_child(int signal)
+{
+  (void)signal;
+}
+
+/* reaps the connections that are done, waiting for one if block is set */
+static int reap_clients(int active, bool block)
+{
+  pid_t pid;
+  while (active > 0 && (pid = waitpid(-1, NULL, block ? 0 : WNOHANG)) != 0)
+  {
+    if (pid < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      /* ECHILD, none are left */
+      return 0;
+    }
+    active--;
+    block = false;
+  }
+  return active;
+}
+
+static int serve_socket(struct VM *vm, struct Script *script, const char *path)
+{
+  /* a stale socket from an earlier run is replaced, anything else is left alone */
+  struct stat st;
+  if (lstat(path, &st) == 0)
+  {
+    if (!S_ISSOCK(st.st_mode))
+    {
+      fprintf(stderr, "server: could not listen on \"%s\": %s.\n", path, strerror(EADDRINUSE));
+      return 74;
+    }
+    unlink(path);
+  }
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+  if (listener < 0 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 64) != 0)
+  {
+    fprintf(stderr, "server: could not listen on \"%s\".\n", path);
+    return 74;
+  }
+
+  struct sigaction action;
+  action.sa_handler = on_child;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = 0;
+  sigaction(SIGCHLD, &action, NULL);
+
+  int active = 0;
+  for (int job = 0;; job++)
+  {
+    active = reap_clients(active, active >= SERVER_MAX_CLIENTS);
+    int client;
+    while ((client = accept(listener, NULL, NULL)) < 0 && errno == EINTR)
+      active = reap_clients(active, false);
+    if (client < 0)
+      break;
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      close(listener);
+      serve_client(vm, script, client, job);
+    }
+    if (pid < 0)
+      fprintf(stderr, "server: could not fork for request %d\n", job);
+    else
+      active++;
+    close(client);
+  }
+  while (active > 0)
+    active = reap_clients(active, true);
+  close(listener);
+  unlink(path);
+  return 0;
+}
+
+int run_server(struct ServerOptions *opts)
+{
+  struct VM vm;
+  init_vm(&vm);
+
+  if (opts->prelude != NULL && interpret(&vm, opts->prelude, strlen(opts->prelude)) != INTERPRET_OK)
+  {
+    free_vm(&vm);
+    return 65;
+  }
+  struct Script *script = cs_compile(&vm, opts->src);
+  if (script == NULL)
+  {
+    free_vm(&vm);
+    return 65;
+  }
+
+  int status = 0;
+  if (opts->socket_path != NULL)
+    status = serve_socket(&vm, script, opts->socket_path);
+  else
+    serve_stdin(&vm, script);
+
+  cs_free_script(script);
+  free_vm(&vm);
+  return status;
+}
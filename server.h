@@ -0,0 +1,18 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+/* connections served at once on a socket, accept waits while this many are open */
+#define SERVER_MAX_CLIENTS 64
+
+struct ServerOptions
+{
+  const char *src;
+  /* optional, run once in the server before any request */
+  const char *prelude;
+  /* listen on this unix socket, read jobs from stdin when NULL */
+  const char *socket_path;
+};
+
+int run_server(struct ServerOptions *opts);
+
+#endif
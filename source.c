@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include "source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* first size of the buffer for streamed input, it doubles from here */
+#define SOURCE_STREAM_CHUNK (64 * 1024)
+
+static size_t page_round(size_t size)
+{
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+/*
+ * the file is mapped over an anonymous reservation one byte longer
+ * than it, so there is a zeroed byte after the text even when the file
+ * ends exactly on a page boundary. the mapping is private and writable
+ * so callers may modify the text in place, pages are only copied if
+ * they do.
+ */
+static bool map_file(struct Source *source, int fd, size_t length)
+{
+  size_t mapped = page_round(length + 1);
+  char *text = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (text == MAP_FAILED)
+    return false;
+  if (length > 0 &&
+      mmap(text, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+  {
+    int err = errno;
+    munmap(text, mapped);
+    errno = err;
+    return false;
+  }
+  source->text = text;
+  source->length = length;
+  source->mapped = mapped;
+  return true;
+}
+
+/* reads straight into anonymous memory that mremap grows in place or moves by page */
+static bool stream_file(struct Source *source, int fd)
+{
+  size_t mapped = SOURCE_STREAM_CHUNK;
+  size_t length = 0;
+  char *text = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (text == MAP_FAILED)
+    return false;
+
+  for (;;)
+  {
+    /* keep a byte free for the terminator */
+    if (mapped - length <= 1)
+    {
+      char *grown = mremap(text, mapped, mapped * 2, MREMAP_MAYMOVE);
+      if (grown == MAP_FAILED)
+        break;
+      text = grown;
+      mapped *= 2;
+    }
+    ssize_t n = read(fd, text + length, mapped - length - 1);
+    if (n == 0)
+    {
+      text[length] = '\0';
+      source->text = text;
+      source->length = length;
+      source->mapped = mapped;
+      return true;
+    }
+    if (n < 0 && errno != EINTR)
+      break;
+    if (n > 0)
+      length += (size_t)n;
+  }
+  int err = errno;
+  munmap(text, mapped);
+  errno = err;
+  return false;
+}
+
+bool load_source(struct Source *source, const char *path)
+{
+  bool is_stdin = strcmp(path, "-") == 0;
+  int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  bool loaded;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+    loaded = map_file(source, fd, (size_t)st.st_size);
+  else
+    loaded = stream_file(source, fd);
+
+  if (!is_stdin)
+  {
+    int err = errno;
+    close(fd);
+    errno = err;
+  }
+  return loaded;
+}
+
+void free_source(struct Source *source)
+{
+  if (source->text != NULL)
+    munmap(source->text, source->mapped);
+  source->text = NULL;
+  source->length = 0;
+  source->mapped = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef SOURCE_H_
+#define SOURCE_H_
+
+#include "common.h"
+
+/*
+ * a script loaded into memory, always followed by a nul. regular files
+ * are mapped rather than copied, anything else (pipes, terminals) is
+ * read in chunks into memory that grows without copying.
+ */
+struct Source
+{
+  char *text;
+  size_t length;
+  /* bytes mapped at text */
+  size_t mapped;
+};
+
+/* "-" reads standard input. false with errno set on failure */
+bool load_source(struct Source *source, const char *path);
+void free_source(struct Source *source);
+
+#endif
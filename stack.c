@@ -0,0 +1,173 @@
+#include "stack.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t page_size;
+static struct sigaction previous_action;
+static atomic_bool guarded;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static pthread_once_t handler_once = PTHREAD_ONCE_INIT;
+static pthread_key_t spare_key;
+
+static __thread struct Stack *watched;
+/*
+ * batch mode starts every run on a fresh vm, the reservation of the
+ * last one freed on a thread is kept for the next rather than mapping
+ * and committing it all over again
+ */
+static __thread Value *spare_slots;
+static __thread size_t spare_committed;
+
+static size_t page_round(size_t size)
+{
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+/* usable bytes, everything but the guard page */
+static size_t stack_limit(void)
+{
+  return STACK_RESERVE - page_size;
+}
+
+/* false only when out of memory, mprotect is safe to call from the fault handler */
+static bool commit(struct Stack *stack, size_t size)
+{
+  size = page_round(size);
+  if (size > stack_limit())
+    size = stack_limit();
+  if (size <= stack->committed)
+    return true;
+  if (mprotect((char *)stack->slots + stack->committed, size - stack->committed,
+               PROT_READ | PROT_WRITE) != 0)
+    return false;
+  stack->committed = size;
+  return true;
+}
+
+/*
+ * runs on the thread that faulted. a fault inside the watched stack is
+ * either growth, handled by committing up to the address and retrying
+ * the access, or a push into the guard page. anything else goes to the
+ * handler that was there before, or crashes the way it would have.
+ */
+static void on_fault(int signal, siginfo_t *info, void *context)
+{
+  struct Stack *stack = watched;
+  char *address = (char *)info->si_addr;
+  if (stack != NULL && address >= (char *)stack->slots &&
+      address < (char *)stack->slots + STACK_RESERVE)
+  {
+    size_t needed = (size_t)(address - (char *)stack->slots) + 1;
+    if (needed <= stack_limit())
+    {
+      if (commit(stack, needed))
+        return;
+      /* out of memory is fatal everywhere else too, only without stdio here */
+      static const char message[] = "Out of memory growing the value stack.\n";
+      write(STDERR_FILENO, message, sizeof(message) - 1);
+      _exit(1);
+    }
+    watched = NULL;
+    siglongjmp(stack->overflow, 1);
+  }
+
+  if (previous_action.sa_flags & SA_SIGINFO)
+    previous_action.sa_sigaction(signal, info, context);
+  else if (previous_action.sa_handler != SIG_DFL && previous_action.sa_handler != SIG_IGN)
+    previous_action.sa_handler(signal);
+  else
+    sigaction(SIGSEGV, &previous_action, NULL);
+}
+
+static void unmap_spare(void *slots)
+{
+  munmap(slots, STACK_RESERVE);
+}
+
+static void setup(void)
+{
+  page_size = (size_t)sysconf(_SC_PAGESIZE);
+  pthread_key_create(&spare_key, unmap_spare);
+}
+
+static void install_handler(void)
+{
+  struct sigaction action;
+  action.sa_sigaction = on_fault;
+  sigemptyset(&action.sa_mask);
+  /* the handler long jumps out, SIGSEGV must not stay blocked after that */
+  action.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigaction(SIGSEGV, &action, &previous_action);
+  atomic_store(&guarded, true);
+}
+
+void guard_stacks(void)
+{
+  pthread_once(&setup_once, setup);
+  pthread_once(&handler_once, install_handler);
+}
+
+bool stacks_guarded(void)
+{
+  return atomic_load(&guarded);
+}
+
+void init_stack(struct Stack *stack)
+{
+  pthread_once(&setup_once, setup);
+  if (spare_slots != NULL)
+  {
+    stack->slots = spare_slots;
+    stack->committed = spare_committed;
+    spare_slots = NULL;
+    pthread_setspecific(spare_key, NULL);
+    return;
+  }
+
+  void *slots = mmap(NULL, STACK_RESERVE, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (slots == MAP_FAILED)
+  {
+    perror("mmap");
+    exit(1);
+  }
+  stack->slots = (Value *)slots;
+  stack->committed = 0;
+}
+
+void free_stack(struct Stack *stack)
+{
+  if (spare_slots == NULL)
+  {
+    spare_slots = stack->slots;
+    spare_committed = stack->committed;
+    /* unmapped when the thread exits */
+    pthread_setspecific(spare_key, spare_slots);
+  }
+  else
+  {
+    munmap(stack->slots, STACK_RESERVE);
+  }
+  stack->slots = NULL;
+  stack->committed = 0;
+}
+
+bool grow_stack(struct Stack *stack, size_t count)
+{
+  if (!commit(stack, count * sizeof(Value)))
+  {
+    perror("mprotect");
+    exit(1);
+  }
+  return count * sizeof(Value) <= stack_limit();
+}
+
+void watch_stack(struct Stack *stack)
+{
+  watched = stack;
+}
@@ -0,0 +1,49 @@
+#ifndef STACK_H_
+#define STACK_H_
+
+#include <setjmp.h>
+#include "common.h"
+#include "value.h"
+
+/* address space reserved for the values of one VM, the last page is a guard */
+#define STACK_RESERVE ((size_t)64 * 1024 * 1024)
+
+/*
+ * the value stack of a VM. the whole reservation is mapped up front
+ * with no access and pages are committed as the stack grows, so it
+ * grows in place and pointers into it stay valid. nothing is ever
+ * committed in the guard page at the end.
+ *
+ * a run commits the depth the verifier worked out for its chunk before
+ * it starts, so it never touches an uncommitted page. once
+ * guard_stacks() has installed the SIGSEGV handler, a push that still
+ * reaches one is committed on the fault, and one that reaches the guard
+ * page jumps back to overflow instead of letting the process crash.
+ */
+struct Stack
+{
+  Value *slots;
+  /* bytes from slots on that can be read and written */
+  size_t committed;
+  sigjmp_buf overflow;
+};
+
+/*
+ * installs the process-wide SIGSEGV handler. it is never installed
+ * behind a host's back: call this once, after any handler of the host's
+ * own, which gets every fault outside a vm stack passed on.
+ */
+void guard_stacks(void);
+bool stacks_guarded(void);
+void init_stack(struct Stack *stack);
+void free_stack(struct Stack *stack);
+/* commits room for count values, or as many as fit before the guard page, false then */
+bool grow_stack(struct Stack *stack, size_t count);
+/*
+ * the stack faults on this thread are checked against while the vm
+ * runs, NULL when it is not running. a fault past the committed pages
+ * commits more, one in the guard page long jumps to stack->overflow.
+ */
+void watch_stack(struct Stack *stack);
+
+#endif
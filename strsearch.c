@@ -0,0 +1,184 @@
+#include "strsearch.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS
+#endif
+
+/*
+ * search compares the needle's first and last byte against a whole
+ * block of candidate positions at once and only runs memcmp where both
+ * match, so a miss costs a couple of vector compares per 16 or 32
+ * bytes. the AVX2 kernels are compiled with a target attribute and
+ * picked at run time so the binary still runs on plain x86-64.
+ */
+
+static int find_scalar(const char *text, int text_length, const char *needle,
+                       int needle_length, int from)
+{
+  for (int i = from; i <= text_length - needle_length; i++)
+  {
+    if (text[i] == needle[0] && memcmp(text + i, needle, needle_length) == 0)
+      return i;
+  }
+  return -1;
+}
+
+static int mismatch_scalar(const char *a, const char *b, int length, int from)
+{
+  for (int i = from; i < length; i++)
+  {
+    if (a[i] != b[i])
+      return i;
+  }
+  return length;
+}
+
+#ifdef __SSE2__
+static int find_sse2(const char *text, int text_length, const char *needle, int needle_length)
+{
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+  int i = 0;
+  for (; i + needle_length - 1 + 16 <= text_length; i += 16)
+  {
+    __m128i block_first = _mm_loadu_si128((const __m128i *)(text + i));
+    __m128i block_last = _mm_loadu_si128((const __m128i *)(text + i + needle_length - 1));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(block_first, first),
+                                                              _mm_cmpeq_epi8(block_last, last)));
+    while (mask != 0)
+    {
+      int at = i + __builtin_ctz(mask);
+      if (memcmp(text + at + 1, needle + 1, needle_length - 2) == 0)
+        return at;
+      mask &= mask - 1;
+    }
+  }
+  return find_scalar(text, text_length, needle, needle_length, i);
+}
+
+static int mismatch_sse2(const char *a, const char *b, int length)
+{
+  int i = 0;
+  for (; i + 16 <= length; i += 16)
+  {
+    __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+    __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+    uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+    if (equal != 0xffff)
+      return i + __builtin_ctz(~equal);
+  }
+  return mismatch_scalar(a, b, length, i);
+}
+#endif
+
+#ifdef HAVE_AVX2_KERNELS
+__attribute__((target("avx2")))
+static int find_avx2(const char *text, int text_length, const char *needle, int needle_length)
+{
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+  int i = 0;
+  for (; i + needle_length - 1 + 32 <= text_length; i += 32)
+  {
+    __m256i block_first = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i block_last = _mm256_loadu_si256((const __m256i *)(text + i + needle_length - 1));
+    uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(block_first, first),
+                                                                    _mm256_cmpeq_epi8(block_last, last)));
+    while (mask != 0)
+    {
+      int at = i + __builtin_ctz(mask);
+      if (memcmp(text + at + 1, needle + 1, needle_length - 2) == 0)
+        return at;
+      mask &= mask - 1;
+    }
+  }
+  return find_scalar(text, text_length, needle, needle_length, i);
+}
+
+__attribute__((target("avx2")))
+static int mismatch_avx2(const char *a, const char *b, int length)
+{
+  int i = 0;
+  for (; i + 32 <= length; i += 32)
+  {
+    __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+    __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+    uint32_t equal = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+    if (equal != 0xffffffffu)
+      return i + __builtin_ctz(~equal);
+  }
+  return mismatch_scalar(a, b, length, i);
+}
+
+/* libgcc fills in the cpu features before main, this is a load and a test */
+static inline bool has_avx2()
+{
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+int str_find(const char *text, int text_length, const char *needle, int needle_length)
+{
+  if (needle_length == 0)
+    return 0;
+  if (needle_length > text_length)
+    return -1;
+  if (needle_length == 1)
+  {
+    const char *at = memchr(text, needle[0], text_length);
+    return at == NULL ? -1 : (int)(at - text);
+  }
+#ifdef HAVE_AVX2_KERNELS
+  if (has_avx2())
+    return find_avx2(text, text_length, needle, needle_length);
+#endif
+#ifdef __SSE2__
+  return find_sse2(text, text_length, needle, needle_length);
+#else
+  return find_scalar(text, text_length, needle, needle_length, 0);
+#endif
+}
+
+int str_count(const char *text, int text_length, const char *needle, int needle_length)
+{
+  /* the empty string matches between every pair of characters */
+  if (needle_length == 0)
+    return text_length + 1;
+
+  int count = 0;
+  int offset = 0;
+  for (;;)
+  {
+    int at = str_find(text + offset, text_length - offset, needle, needle_length);
+    if (at < 0)
+      return count;
+    count++;
+    offset += at + needle_length;
+  }
+}
+
+int str_mismatch(const char *a, const char *b, int length)
+{
+#ifdef HAVE_AVX2_KERNELS
+  if (has_avx2())
+    return mismatch_avx2(a, b, length);
+#endif
+#ifdef __SSE2__
+  return mismatch_sse2(a, b, length);
+#else
+  return mismatch_scalar(a, b, length, 0);
+#endif
+}
+
+int str_compare(const char *a, int a_length, const char *b, int b_length)
+{
+  int length = a_length < b_length ? a_length : b_length;
+  int at = str_mismatch(a, b, length);
+  if (at < length)
+    return (int)(unsigned char)a[at] - (int)(unsigned char)b[at];
+  return a_length - b_length;
+}
@@ -0,0 +1,15 @@
+#ifndef STRSEARCH_H_
+#define STRSEARCH_H_
+
+#include "common.h"
+
+/* index of the first occurrence of needle in text, -1 if there is none */
+int str_find(const char *text, int text_length, const char *needle, int needle_length);
+/* non-overlapping occurrences of needle in text */
+int str_count(const char *text, int text_length, const char *needle, int needle_length);
+/* index of the first byte where a and b differ, length if they don't */
+int str_mismatch(const char *a, const char *b, int length);
+/* <0, 0 or >0 as a sorts before, equal to or after b, bytewise */
+int str_compare(const char *a, int a_length, const char *b, int b_length);
+
+#endif
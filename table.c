@@ -3,77 +3,155 @@
 #include "memory.h"
 #include "value.h"
 
+#include <stdio.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define TABLE_MAX_LOAD 0.75
+/* max fraction of slots that may be full or tombstones, as x/8 */
+#define TABLE_MAX_LOAD 7
+
+/* tombstones above capacity / this trigger a rebuild on delete */
+#define TABLE_MAX_TOMBSTONES 4
+/* live entries below capacity / this shrink the table on delete */
+#define TABLE_MIN_LOAD 8
+
+#define CTRL_EMPTY   ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xfe)
+
+/*
+ * the hash is split in two, the high bits pick the first group to
+ * probe and the low 7 bits are stored in the control byte so most
+ * mismatches are rejected without touching the entry
+ */
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((uint8_t)((hash) & 0x7f))
+
+/* bitmasks with bit i set when control byte i of the group matches */
+#ifdef __SSE2__
+static inline uint32_t group_match(const uint8_t *group, uint8_t h2)
+{
+  __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+}
+
+static inline uint32_t group_match_empty(const uint8_t *group)
+{
+  return group_match(group, CTRL_EMPTY);
+}
+
+/* EMPTY and DELETED are the only control bytes with the top bit set */
+static inline uint32_t group_match_free(const uint8_t *group)
+{
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+#else
+static inline uint32_t group_match(const uint8_t *group, uint8_t h2)
+{
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP_WIDTH; i++)
+    mask |= (uint32_t)(group[i] == h2) << i;
+  return mask;
+}
+
+static inline uint32_t group_match_empty(const uint8_t *group)
+{
+  return group_match(group, CTRL_EMPTY);
+}
+
+static inline uint32_t group_match_free(const uint8_t *group)
+{
+  uint32_t mask = 0;
+  for (int i = 0; i < TABLE_GROUP_WIDTH; i++)
+    mask |= (uint32_t)(group[i] >> 7) << i;
+  return mask;
+}
+#endif
 
 void init_table(struct Table *table)
 {
   table->count = 0;
+  table->tombstones = 0;
   table->capacity = 0;
+  table->ctrl = NULL;
   table->entries = NULL;
 }
 
 void free_table(struct Table *table)
 {
+  reallocate(table->ctrl, sizeof(uint8_t) * table->capacity, 0);
   reallocate(table->entries, sizeof(struct Entry) * table->capacity, 0);
   init_table(table);
 }
 
-static struct Entry *find_entry(struct Entry *entries, int capacity, struct ObjString *key)
+/*
+ * groups are probed in triangular order (g, g+1, g+3, g+6...) which
+ * visits every group once when the group count is a power of two
+ */
+static int find_slot(struct Table *table, struct ObjString *key)
 {
-  uint32_t index = key->hash % capacity;
-  struct Entry *tombstone = NULL;
-  for (;;)
+  uint32_t group_mask = (uint32_t)(table->capacity / TABLE_GROUP_WIDTH) - 1;
+  uint32_t group = H1(key->hash) & group_mask;
+  uint8_t h2 = H2(key->hash);
+  for (uint32_t step = 1;; step++)
   {
-    struct Entry *entry = &entries[index];
-    if (entry->key == NULL)
+    const uint8_t *ctrl = &table->ctrl[group * TABLE_GROUP_WIDTH];
+    for (uint32_t match = group_match(ctrl, h2); match != 0; match &= match - 1)
     {
-      /* empty entry */
-      if (IS_NIL(entry->value))
-        return tombstone != NULL ? tombstone : entry;
-      /* tombstone found */
-      else if (tombstone == NULL)
-        tombstone = entry;
+      int slot = group * TABLE_GROUP_WIDTH + __builtin_ctz(match);
+      if (table->entries[slot].key == key)
+        return slot;
     }
-    else if (entry->key == key)
-      return entry;
-    
-    /* probe until key is found or an empty bucket is found */
-    index = (index + 1) % capacity;
+    /* an empty slot ends every probe sequence that reached this group */
+    if (group_match_empty(ctrl) != 0)
+      return -1;
+    group = (group + step) & group_mask;
   }
 }
 
-static void adjust_capacity(struct Table *table, int capacity)
+/* first empty or deleted slot on the key's probe sequence */
+static int find_free_slot(uint8_t *ctrl, int capacity, uint32_t hash)
 {
-  struct Entry *entries = (struct Entry *)reallocate(NULL, 0, sizeof(struct Entry) * capacity);  
-  for (int i = 0; i < capacity; i++)
+  uint32_t group_mask = (uint32_t)(capacity / TABLE_GROUP_WIDTH) - 1;
+  uint32_t group = H1(hash) & group_mask;
+  for (uint32_t step = 1;; step++)
   {
-    entries[i].key = NULL;
-    entries[i].value = NIL_VAL;
+    uint32_t match = group_match_free(&ctrl[group * TABLE_GROUP_WIDTH]);
+    if (match != 0)
+      return group * TABLE_GROUP_WIDTH + __builtin_ctz(match);
+    group = (group + step) & group_mask;
   }
+}
+
+static void adjust_capacity(struct Table *table, int capacity)
+{
+  uint8_t *ctrl = (uint8_t *)reallocate(NULL, 0, sizeof(uint8_t) * capacity);
+  struct Entry *entries = (struct Entry *)reallocate(NULL, 0, sizeof(struct Entry) * capacity);
+  memset(ctrl, CTRL_EMPTY, capacity);
 
   /*
    * when rebuilding a table, tombstones are omitted
    * they serve no value since we are rebuilding the
    * probe sequences anyway
    */
-  table->count = 0;
   for (int i = 0; i < table->capacity; i++)
   {
-    struct Entry *entry = &table->entries[i];
-    if (entry->key == NULL)
+    if (table->ctrl[i] & 0x80)
       continue;
-    
-    struct Entry *dest = find_entry(entries, capacity, entry->key); 
-    dest->key = entry->key; 
-    dest->value = entry->value;
-    table->count++;
+
+    struct Entry *entry = &table->entries[i];
+    int dest = find_free_slot(ctrl, capacity, entry->key->hash);
+    ctrl[dest] = table->ctrl[i];
+    entries[dest] = *entry;
   }
 
-  reallocate(table->entries, sizeof(struct Entry *) * table->capacity, 0);
+  reallocate(table->ctrl, sizeof(uint8_t) * table->capacity, 0);
+  reallocate(table->entries, sizeof(struct Entry) * table->capacity, 0);
+  table->ctrl = ctrl;
   table->entries = entries;
   table->capacity = capacity;
+  table->tombstones = 0;
 }
 
 bool table_get(struct Table *table, struct ObjString *key, Value *value)
@@ -81,36 +159,44 @@ bool table_get(struct Table *table, struct ObjString *key, Value *value)
   if (table->count == 0)
     return false;
   
-  struct Entry *entry = find_entry(table->entries, table->capacity, key);
-  if (entry->key == NULL)
+  int slot = find_slot(table, key);
+  if (slot < 0)
     return false;
 
-  *value = entry->value;
+  *value = table->entries[slot].value;
   return true;
 }
 
 bool table_set(struct Table *table, struct ObjString *key, Value value)
 {
-  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD)
+  int slot = table->capacity > 0 ? find_slot(table, key) : -1;
+  if (slot >= 0)
   {
-    int capacity = (table->capacity < 8) ? 8 : table->capacity * 2;
-    adjust_capacity(table, capacity);
+    table->entries[slot].value = value;
+    return false;
   }
 
-  struct Entry *entry = find_entry(table->entries, table->capacity, key);
-  bool is_new_key = (entry->key == NULL);
   /*
-   * we dont reduce count when an element is deleted
-   * since tombstones are treated like full buckets
-   * similarly, we also dont increase count if the new entry
-   * is a tombstone
+   * tombstones still lengthen probe sequences so they count towards
+   * the load, when they make up most of it rebuilding at the same
+   * size is enough to get rid of them
    */
-  if (is_new_key && IS_NIL(entry->value))
-    table->count++;
-  
-  entry->key = key;
-  entry->value = value;
-  return is_new_key;
+  if ((table->count + table->tombstones + 1) * 8 > table->capacity * TABLE_MAX_LOAD)
+  {
+    int capacity = table->capacity < TABLE_GROUP_WIDTH ? TABLE_GROUP_WIDTH : table->capacity;
+    if ((table->count + 1) * 16 > capacity * TABLE_MAX_LOAD)
+      capacity *= 2;
+    adjust_capacity(table, capacity);
+  }
+
+  slot = find_free_slot(table->ctrl, table->capacity, key->hash);
+  if (table->ctrl[slot] == CTRL_DELETED)
+    table->tombstones--;
+  table->ctrl[slot] = H2(key->hash);
+  table->entries[slot].key = key;
+  table->entries[slot].value = value;
+  table->count++;
+  return true;
 }
 
 bool table_delete(struct Table *table, struct ObjString *key)
@@ -118,12 +204,42 @@ bool table_delete(struct Table *table, struct ObjString *key)
   if (table->count == 0)
     return false;
 
-  struct Entry *entry = find_entry(table->entries, table->capacity, key);
-  if (entry->key == NULL)
+  int slot = find_slot(table, key);
+  if (slot < 0)
     return false;
 
-  entry->key = NULL;
-  entry->value = BOOL_VAL(true);
+  /*
+   * a group that still has an empty slot has never been full, so no
+   * probe sequence ever went past it and the slot can simply be freed,
+   * otherwise it has to become a tombstone
+   */
+  const uint8_t *group = &table->ctrl[slot & ~(TABLE_GROUP_WIDTH - 1)];
+  if (group_match_empty(group) != 0)
+    table->ctrl[slot] = CTRL_EMPTY;
+  else
+  {
+    table->ctrl[slot] = CTRL_DELETED;
+    table->tombstones++;
+  }
+  table->entries[slot].key = NULL;
+  table->entries[slot].value = NIL_VAL;
+  table->count--;
+
+  /*
+   * without this, heavy define/undefine churn leaves the table full of
+   * tombstones that lengthen every probe until the next growth, and a
+   * table that once held many keys would keep its size forever
+   */
+  if (table->count * TABLE_MIN_LOAD < table->capacity &&
+      table->capacity > TABLE_GROUP_WIDTH)
+  {
+    int capacity = table->capacity;
+    while (capacity > TABLE_GROUP_WIDTH && table->count * 4 < capacity)
+      capacity /= 2;
+    adjust_capacity(table, capacity);
+  }
+  else if (table->tombstones * TABLE_MAX_TOMBSTONES > table->capacity)
+    adjust_capacity(table, table->capacity);
   return true;
 }
 
@@ -132,21 +248,76 @@ struct ObjString *table_find_str(struct Table *table, const char *c_str, int len
   if (table->count == 0)
     return NULL;
 
-  uint32_t index = hash % table->capacity;
-  for (;;)
+  uint32_t group_mask = (uint32_t)(table->capacity / TABLE_GROUP_WIDTH) - 1;
+  uint32_t group = H1(hash) & group_mask;
+  uint8_t h2 = H2(hash);
+  for (uint32_t step = 1;; step++)
   {
-    struct Entry* entry = &table->entries[index];
-    if (entry->key == NULL && IS_NIL(entry->value))
-      /*
-       * stop if we find an empty non-tombstone entry
-       * if its a tombstone can still try to find the string
-       * by probing
-       */
+    const uint8_t *ctrl = &table->ctrl[group * TABLE_GROUP_WIDTH];
+    for (uint32_t match = group_match(ctrl, h2); match != 0; match &= match - 1)
+    {
+      struct ObjString *key = table->entries[group * TABLE_GROUP_WIDTH + __builtin_ctz(match)].key;
+      if (key->hash == hash && key->length == length &&
+          memcmp(key->chars, c_str, length) == 0)
+        return key;
+    }
+    if (group_match_empty(ctrl) != 0)
       return NULL;
-    else if (entry->key->length == length &&
-             entry->key->hash == hash &&
-      memcmp(entry->key->c_str, c_str, (int)length) == 0)
-      return entry->key;
-    index = (index + 1) % table->capacity;
+    group = (group + step) & group_mask;
+  }
+}
+
+/* number of groups probed before reaching the key, 1 means its home group */
+static int probe_length(struct Table *table, int slot)
+{
+  uint32_t group_mask = (uint32_t)(table->capacity / TABLE_GROUP_WIDTH) - 1;
+  uint32_t group = H1(table->entries[slot].key->hash) & group_mask;
+  uint32_t target = (uint32_t)slot / TABLE_GROUP_WIDTH;
+  int length = 1;
+  for (uint32_t step = 1; group != target; step++, length++)
+    group = (group + step) & group_mask;
+  return length;
+}
+
+void table_stats(struct Table *table, struct TableStats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->count = table->count;
+  stats->tombstones = table->tombstones;
+  stats->capacity = table->capacity;
+  if (table->capacity == 0)
+    return;
+
+  stats->load_factor = (double)table->count / table->capacity;
+  stats->tombstone_ratio = (double)table->tombstones / table->capacity;
+  long total = 0;
+  for (int i = 0; i < table->capacity; i++)
+  {
+    if (table->ctrl[i] & 0x80)
+      continue;
+    int length = probe_length(table, i);
+    total += length;
+    if (length > stats->max_probe)
+      stats->max_probe = length;
+    stats->probe_histogram[length < TABLE_PROBE_BUCKETS ? length - 1 : TABLE_PROBE_BUCKETS - 1]++;
+  }
+  if (table->count > 0)
+    stats->avg_probe = (double)total / table->count;
+}
+
+void print_table_stats(const char *name, struct Table *table)
+{
+  struct TableStats stats;
+  table_stats(table, &stats);
+  fprintf(stderr, "table %s: %d entries, %d tombstones, capacity %d\n",
+          name, stats.count, stats.tombstones, stats.capacity);
+  fprintf(stderr, "  load %.3f, tombstones %.3f, probe avg %.3f max %d groups\n",
+          stats.load_factor, stats.tombstone_ratio, stats.avg_probe, stats.max_probe);
+  for (int i = 0; i < TABLE_PROBE_BUCKETS; i++)
+  {
+    if (stats.probe_histogram[i] == 0)
+      continue;
+    fprintf(stderr, "  %s%d groups: %d\n", i == TABLE_PROBE_BUCKETS - 1 ? ">=" : "",
+            i + 1, stats.probe_histogram[i]);
   }
 }
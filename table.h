@@ -4,24 +4,54 @@
 #include "common.h"
 #include "value.h"
 
+/* slots are probed in aligned groups of this many control bytes */
+#define TABLE_GROUP_WIDTH 16
+
 struct Entry
 {
   struct ObjString *key;
   Value value;
 };
 
+/*
+ * open addressing table in the swiss table layout. next to the entries
+ * there is one control byte per slot holding either EMPTY, DELETED or
+ * the low 7 bits of the key's hash, so probing only reads the control
+ * bytes (a whole group at a time) and touches an entry only when its
+ * hash fragment matches. capacity is always a power of two and a
+ * multiple of the group width.
+ */
 struct Table
 {
   int count;
+  int tombstones;
   int capacity;
+  uint8_t *ctrl;
   struct Entry *entries;
 };
 
+/* probe lengths are counted in groups, the last bucket takes the rest */
+#define TABLE_PROBE_BUCKETS 8
+
+struct TableStats
+{
+  int count;
+  int tombstones;
+  int capacity;
+  double load_factor;
+  double tombstone_ratio;
+  double avg_probe;
+  int max_probe;
+  int probe_histogram[TABLE_PROBE_BUCKETS];
+};
+
 void init_table(struct Table *table);
 void free_table(struct Table *table);
 bool table_get(struct Table *table, struct ObjString *key, Value *value);
 bool table_set(struct Table *table, struct ObjString *key, Value value);
 bool table_delete(struct Table *table, struct ObjString *key);
 struct ObjString *table_find_str(struct Table *table, const char *c_str, int length, uint32_t hash);
+void table_stats(struct Table *table, struct TableStats *stats);
+void print_table_stats(const char *name, struct Table *table);
 
 #endif
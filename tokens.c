@@ -0,0 +1,197 @@
+#include "tokens.h"
+#include "memory.h"
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+
+/* sources at least this long are scanned on a separate thread */
+#define TOKEN_THREAD_MIN_SOURCE (1 << 20)
+/* slots in the ring, a power of two */
+#define TOKEN_RING_SIZE 65536
+/* how often each side tells the other how far it got */
+#define TOKEN_PUBLISH_EVERY 64
+
+void init_token_buffer(struct TokenBuffer *buffer, const char *src)
+{
+  buffer->src = src;
+  buffer->types = NULL;
+  buffer->offsets = NULL;
+  buffer->lengths = NULL;
+  buffer->lines = NULL;
+  buffer->count = 0;
+  buffer->capacity = 0;
+}
+
+static void resize_token_buffer(struct TokenBuffer *buffer, int capacity)
+{
+  size_t old = (size_t)buffer->capacity;
+  buffer->types = (uint8_t *)reallocate(buffer->types, old * sizeof(uint8_t),
+                                        capacity * sizeof(uint8_t));
+  buffer->offsets = (uint32_t *)reallocate(buffer->offsets, old * sizeof(uint32_t),
+                                           capacity * sizeof(uint32_t));
+  buffer->lengths = (uint32_t *)reallocate(buffer->lengths, old * sizeof(uint32_t),
+                                           capacity * sizeof(uint32_t));
+  buffer->lines = (int *)reallocate(buffer->lines, old * sizeof(int), capacity * sizeof(int));
+  buffer->capacity = capacity;
+}
+
+void free_token_buffer(struct TokenBuffer *buffer)
+{
+  resize_token_buffer(buffer, 0);
+  init_token_buffer(buffer, buffer->src);
+}
+
+static void store_token(struct TokenBuffer *buffer, int index, struct Token token)
+{
+  buffer->types[index] = (uint8_t)token.type;
+  buffer->lines[index] = token.line;
+  if (token.type == TOKEN_ERROR)
+  {
+    /* error tokens point at a static message, its address is split over both columns */
+    uint64_t message = (uint64_t)(uintptr_t)token.start;
+    buffer->offsets[index] = (uint32_t)message;
+    buffer->lengths[index] = (uint32_t)(message >> 32);
+    return;
+  }
+  buffer->offsets[index] = (uint32_t)(token.start - buffer->src);
+  buffer->lengths[index] = (uint32_t)token.length;
+}
+
+struct Token token_at(const struct TokenBuffer *buffer, int index)
+{
+  struct Token token;
+  token.type = (enum TokenType)buffer->types[index];
+  token.line = buffer->lines[index];
+  if (token.type == TOKEN_ERROR)
+  {
+    uint64_t message = ((uint64_t)buffer->lengths[index] << 32) | buffer->offsets[index];
+    token.start = (const char *)(uintptr_t)message;
+    token.length = (int)strlen(token.start);
+    return token;
+  }
+  token.start = buffer->src + buffer->offsets[index];
+  token.length = (int)buffer->lengths[index];
+  return token;
+}
+
+void lex_source(struct TokenBuffer *buffer, const char *src, size_t length)
+{
+  struct Scanner scanner;
+  init_token_buffer(buffer, src);
+  init_scanner(&scanner, src, length);
+  for (;;)
+  {
+    if (buffer->count == buffer->capacity)
+      resize_token_buffer(buffer, buffer->capacity < 64 ? 64 : buffer->capacity * 2);
+    struct Token token = scan_token(&scanner);
+    store_token(buffer, buffer->count++, token);
+    if (token.type == TOKEN_EOF)
+      return;
+  }
+}
+
+static void *scanner_main(void *arg)
+{
+  struct TokenStream *stream = (struct TokenStream *)arg;
+  uint32_t written = 0;
+  uint32_t consumed = 0;
+  for (;;)
+  {
+    /* the ring is full, show the compiler everything and wait for room */
+    while (written - consumed == TOKEN_RING_SIZE)
+    {
+      atomic_store_explicit(&stream->written, written, memory_order_release);
+      if (atomic_load_explicit(&stream->closing, memory_order_relaxed))
+        return NULL;
+      consumed = atomic_load_explicit(&stream->consumed, memory_order_acquire);
+      if (written - consumed == TOKEN_RING_SIZE)
+        sched_yield();
+    }
+
+    struct Token token = scan_token(&stream->scanner);
+    store_token(&stream->buffer, (int)(written & (TOKEN_RING_SIZE - 1)), token);
+    written++;
+    if (token.type == TOKEN_EOF)
+    {
+      atomic_store_explicit(&stream->written, written, memory_order_release);
+      return NULL;
+    }
+    if (written % TOKEN_PUBLISH_EVERY == 0)
+      atomic_store_explicit(&stream->written, written, memory_order_release);
+  }
+}
+
+bool open_tokens(struct TokenStream *stream, const char *src, size_t length)
+{
+  if (length > TOKEN_SOURCE_MAX)
+    return false;
+  stream->read = 0;
+  stream->at_end = false;
+  stream->available = 0;
+  atomic_init(&stream->written, 0);
+  atomic_init(&stream->consumed, 0);
+  atomic_init(&stream->closing, false);
+
+  /* a second thread only pays off with a core to run it on */
+  stream->threaded = length >= TOKEN_THREAD_MIN_SOURCE &&
+                     sysconf(_SC_NPROCESSORS_ONLN) > 1;
+  if (stream->threaded)
+  {
+    init_token_buffer(&stream->buffer, src);
+    resize_token_buffer(&stream->buffer, TOKEN_RING_SIZE);
+    init_scanner(&stream->scanner, src, length);
+    if (pthread_create(&stream->thread, NULL, scanner_main, stream) == 0)
+      return true;
+    free_token_buffer(&stream->buffer);
+    stream->threaded = false;
+  }
+  lex_source(&stream->buffer, src, length);
+  return true;
+}
+
+/* blocks until the scanner thread has published the token at read */
+static void wait_for_tokens(struct TokenStream *stream)
+{
+  atomic_store_explicit(&stream->consumed, stream->read, memory_order_release);
+  for (;;)
+  {
+    stream->available = atomic_load_explicit(&stream->written, memory_order_acquire);
+    if (stream->read != stream->available)
+      return;
+    sched_yield();
+  }
+}
+
+struct Token next_token(struct TokenStream *stream)
+{
+  if (!stream->threaded)
+  {
+    struct Token token = token_at(&stream->buffer, (int)stream->read);
+    /* the last token is EOF, keep handing it out */
+    if ((int)stream->read < stream->buffer.count - 1)
+      stream->read++;
+    return token;
+  }
+
+  if (stream->at_end)
+    return token_at(&stream->buffer, (int)((stream->read - 1) & (TOKEN_RING_SIZE - 1)));
+  if (stream->read == stream->available)
+    wait_for_tokens(stream);
+  struct Token token = token_at(&stream->buffer, (int)(stream->read & (TOKEN_RING_SIZE - 1)));
+  stream->read++;
+  stream->at_end = token.type == TOKEN_EOF;
+  /* the slot can be reused once the token is copied out */
+  if (stream->read % TOKEN_PUBLISH_EVERY == 0)
+    atomic_store_explicit(&stream->consumed, stream->read, memory_order_release);
+  return token;
+}
+
+void close_tokens(struct TokenStream *stream)
+{
+  if (stream->threaded)
+  {
+    atomic_store_explicit(&stream->closing, true, memory_order_relaxed);
+    pthread_join(stream->thread, NULL);
+  }
+  free_token_buffer(&stream->buffer);
+}
@@ -0,0 +1,63 @@
+#ifndef TOKENS_H_
+#define TOKENS_H_
+
+#include "common.h"
+#include "scanner.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * longest source accepted. every token but EOF takes at least a byte,
+ * so such a source has at most 2^30 tokens: count and capacity stay
+ * ints, capacity never doubles past 2^30, and offsets fit 32 bits
+ */
+#define TOKEN_SOURCE_MAX (((size_t)1 << 30) - 1)
+
+/*
+ * scanned tokens stored column by column, start pointers are kept as
+ * offsets into the source, so sources are limited to TOKEN_SOURCE_MAX.
+ */
+struct TokenBuffer
+{
+  const char *src;
+  uint8_t *types;
+  uint32_t *offsets;
+  uint32_t *lengths;
+  int *lines;
+  int count;
+  int capacity;
+};
+
+void init_token_buffer(struct TokenBuffer *buffer, const char *src);
+void free_token_buffer(struct TokenBuffer *buffer);
+/* scans all of src into buffer, the last token is TOKEN_EOF */
+void lex_source(struct TokenBuffer *buffer, const char *src, size_t length);
+struct Token token_at(const struct TokenBuffer *buffer, int index);
+
+/*
+ * what the compiler reads tokens from. small sources are scanned up
+ * front into a buffer, large ones are scanned on a thread of their own
+ * into a fixed ring of the same columns while the compiler consumes
+ * them, so scanning overlaps code generation.
+ */
+struct TokenStream
+{
+  struct TokenBuffer buffer;
+  uint32_t read;
+  bool at_end;
+  bool threaded;
+  /* ring mode only, the compiler's last look at written */
+  uint32_t available;
+  struct Scanner scanner;
+  pthread_t thread;
+  _Alignas(64) _Atomic uint32_t written;
+  _Alignas(64) _Atomic uint32_t consumed;
+  _Atomic bool closing;
+};
+
+/* src is length bytes followed by a nul, false when it is over TOKEN_SOURCE_MAX */
+bool open_tokens(struct TokenStream *stream, const char *src, size_t length);
+struct Token next_token(struct TokenStream *stream);
+void close_tokens(struct TokenStream *stream);
+
+#endif
@@ -0,0 +1,105 @@
+#include "compiler.h"
+#include "disassem.h"
+#include "source.h"
+#include "trace.h"
+#include "vm.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * renders a trace written by C-Script --trace. the script the trace
+ * came from is compiled again, compiling is deterministic so offsets
+ * in the trace point at the same instructions, and every event is
+ * printed as the time since the first one, the time until the next one
+ * (what the instruction took, near enough), the stack depth before it
+ * and its disassembly.
+ *
+ *   tools/trace_decode script.cs trace.bin
+ */
+
+static struct TraceEvent *read_events(const char *path, struct TraceHeader *header)
+{
+  FILE *file = fopen(path, "rb");
+  if (file == NULL)
+  {
+    fprintf(stderr, "Could not open trace \"%s\": %s.\n", path, strerror(errno));
+    exit(74);
+  }
+  if (fread(header, sizeof(*header), 1, file) != 1 ||
+      memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0)
+  {
+    fprintf(stderr, "\"%s\" is not a trace.\n", path);
+    exit(65);
+  }
+
+  struct TraceEvent *events = (struct TraceEvent *)malloc(sizeof(struct TraceEvent) *
+                                                          (header->count + 1));
+  if (events == NULL || fread(events, sizeof(struct TraceEvent), header->count, file) != header->count)
+  {
+    fprintf(stderr, "Trace \"%s\" is cut short.\n", path);
+    exit(65);
+  }
+  fclose(file);
+  return events;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "Usage: trace_decode script trace\n");
+    return 64;
+  }
+
+  struct Source source;
+  if (!load_source(&source, argv[1]))
+  {
+    fprintf(stderr, "Could not read file \"%s\": %s.\n", argv[1], strerror(errno));
+    return 74;
+  }
+  struct VM vm;
+  init_vm(&vm);
+  struct Chunk chunk;
+  init_chunk(&chunk);
+  if (!compile(&vm, source.text, source.length, &chunk))
+    return 65;
+
+  struct TraceHeader header;
+  struct TraceEvent *events = read_events(argv[2], &header);
+  for (uint64_t i = 0; i < header.count; i++)
+  {
+    struct TraceEvent *event = &events[i];
+    if (event->offset >= (uint32_t)chunk.count || chunk.code[event->offset] != trace_opcode(event))
+    {
+      fprintf(stderr, "Event %" PRIu64 " does not match \"%s\", was the trace written for it?\n",
+              i, argv[1]);
+      return 65;
+    }
+  }
+
+  printf("%" PRIu64 " events", header.count);
+  if (header.dropped > 0)
+    printf(", the %" PRIu64 " before them were overwritten", header.dropped);
+  printf("\n%14s %8s %6s\n", "since start", "took", "depth");
+
+  for (uint64_t i = 0; i < header.count; i++)
+  {
+    struct TraceEvent *event = &events[i];
+    if (i + 1 < header.count)
+      printf("%14" PRIu64 " %8" PRIu64 " %6u  ", event->tsc - events[0].tsc,
+             events[i + 1].tsc - event->tsc, trace_depth(event));
+    else
+      printf("%14" PRIu64 " %8s %6u  ", event->tsc - events[0].tsc, "", trace_depth(event));
+    disassem_instruction(&chunk, (int)event->offset);
+    printf("\n");
+  }
+
+  free(events);
+  free_chunk(&chunk);
+  free_vm(&vm);
+  free_source(&source);
+  return 0;
+}
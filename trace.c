@@ -0,0 +1,52 @@
+#include "trace.h"
+#include "memory.h"
+#include <string.h>
+
+void init_trace(struct Trace *trace, size_t events)
+{
+  size_t capacity = 1;
+  while (capacity < events)
+    capacity *= 2;
+  trace->events = (struct TraceEvent *)reallocate(NULL, 0, sizeof(struct TraceEvent) * capacity);
+  trace->mask = capacity - 1;
+  atomic_init(&trace->head, 0);
+}
+
+void free_trace(struct Trace *trace)
+{
+  reallocate(trace->events, sizeof(struct TraceEvent) * (trace->mask + 1), 0);
+  trace->events = NULL;
+  trace->mask = 0;
+}
+
+/*
+ * copies the ring oldest first and then checks how far the writer got
+ * in the meantime. every slot it may have reused since the copy
+ * started, including the one it could be half way through, is dropped
+ * from the front.
+ */
+bool write_trace(struct Trace *trace, FILE *file)
+{
+  uint64_t capacity = trace->mask + 1;
+  uint64_t end = atomic_load_explicit(&trace->head, memory_order_acquire);
+  uint64_t start = end > capacity ? end - capacity : 0;
+
+  struct TraceEvent *copy = (struct TraceEvent *)reallocate(NULL, 0,
+                                                            sizeof(struct TraceEvent) * (end - start + 1));
+  for (uint64_t i = start; i < end; i++)
+    copy[i - start] = trace->events[i & trace->mask];
+  atomic_thread_fence(memory_order_acquire);
+  uint64_t written = atomic_load_explicit(&trace->head, memory_order_relaxed);
+  uint64_t first = written >= capacity && written - capacity + 1 > start ? written - capacity + 1 : start;
+  if (first > end)
+    first = end;
+
+  struct TraceHeader header;
+  memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+  header.count = end - first;
+  header.dropped = first;
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(copy + (first - start), sizeof(struct TraceEvent), header.count, file) == header.count;
+  reallocate(copy, sizeof(struct TraceEvent) * (end - start + 1), 0);
+  return ok;
+}
@@ -0,0 +1,89 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include "common.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#else
+#include <time.h>
+#endif
+
+/* events kept by default, once the ring is full the oldest are overwritten */
+#define TRACE_EVENTS (1 << 20)
+#define TRACE_MAGIC "CSTRACE1"
+
+/* one instruction about to run, stored in trace files as is */
+struct TraceEvent
+{
+  uint64_t tsc;
+  uint32_t offset;
+  /* stack depth in the low 24 bits, the opcode in the high 8 */
+  uint32_t depth_op;
+};
+
+/* what a trace file starts with, the events follow oldest first */
+struct TraceHeader
+{
+  char magic[8];
+  uint64_t count;
+  /* events overwritten before the trace was written */
+  uint64_t dropped;
+};
+
+/*
+ * a ring of the most recent events of one VM. only the thread running
+ * the VM writes, it fills a slot and then publishes it by moving head
+ * with a release store, so a reader on any thread can copy the ring
+ * without a lock and throw away whatever was overwritten meanwhile.
+ */
+struct Trace
+{
+  struct TraceEvent *events;
+  uint64_t mask;
+  /* events recorded so far */
+  _Atomic uint64_t head;
+};
+
+/* cycles where there is a timestamp counter, nanoseconds elsewhere */
+static inline uint64_t read_tsc(void)
+{
+#ifdef HAVE_TSC
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static inline void trace_instruction(struct Trace *trace, uint32_t offset, uint8_t opcode,
+                                     uint32_t depth)
+{
+  uint64_t head = atomic_load_explicit(&trace->head, memory_order_relaxed);
+  struct TraceEvent *event = &trace->events[head & trace->mask];
+  event->tsc = read_tsc();
+  event->offset = offset;
+  event->depth_op = ((uint32_t)opcode << 24) | (depth & 0xffffff);
+  atomic_store_explicit(&trace->head, head + 1, memory_order_release);
+}
+
+static inline uint8_t trace_opcode(const struct TraceEvent *event)
+{
+  return (uint8_t)(event->depth_op >> 24);
+}
+
+static inline uint32_t trace_depth(const struct TraceEvent *event)
+{
+  return event->depth_op & 0xffffff;
+}
+
+/* room for at least events events, rounded up to a power of two */
+void init_trace(struct Trace *trace, size_t events);
+void free_trace(struct Trace *trace);
+/* a consistent snapshot of the ring, safe while the VM is still running */
+bool write_trace(struct Trace *trace, FILE *file);
+
+#endif
@@ -1,5 +1,6 @@
 #include "value.h"
 #include "memory.h"
+#include "number.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -15,7 +16,20 @@ bool values_equal(Value a, Value b)
     case VAL_BOOL:    return AS_BOOL(a) == AS_BOOL(b);
     case VAL_NIL:     return true;
     case VAL_NUMBER:  return AS_NUMBER(a) == AS_NUMBER(b);
-    case VAL_OBJ:     return AS_OBJ(a) == AS_OBJ(b);
+    case VAL_OBJ:
+    {
+      if (AS_OBJ(a) == AS_OBJ(b))
+        return true;
+      if (!IS_STRING(a) || !IS_STRING(b))
+        return false;
+      /* two interned strings are only ever equal to themselves */
+      struct ObjString *str_a = AS_STRING(a);
+      struct ObjString *str_b = AS_STRING(b);
+      if (str_a->interned && str_b->interned)
+        return false;
+      return str_a->length == str_b->length &&
+             memcmp(str_a->chars, str_b->chars, str_a->length) == 0;
+    }
     default:          return false;
   }
 }
@@ -28,7 +42,13 @@ void print_value(Value value, bool align)
       printf(align ? "%-16s" : "%s", AS_BOOL(value) ? "true" : "false");
       break;
     case VAL_NIL:    printf(align ? "%-16s" : "%s", "nil"); break;
-    case VAL_NUMBER: printf(align ? "%-16g" : "%g", AS_NUMBER(value)); break;
+    case VAL_NUMBER:
+    {
+      char buffer[NUMBER_MAX_LENGTH + 1];
+      format_number(AS_NUMBER(value), buffer);
+      printf(align ? "%-16s" : "%s", buffer);
+      break;
+    }
     case VAL_OBJ: print_obj(value, align); break;
   }
 }
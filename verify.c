@@ -0,0 +1,354 @@
+#include "verify.h"
+#include "memory.h"
+#include "object.h"
+#include <stdio.h>
+#include <string.h>
+
+/* the depth of a jump target no path has reached yet */
+#define UNREACHED -1
+
+/*
+ * per byte of code the verifier keeps two bits, where instructions
+ * start and which of them are jump targets. depths are only stored for
+ * the targets, found by counting the target bits before them.
+ */
+struct Verifier
+{
+  struct Chunk *chunk;
+  int words;
+  uint64_t *starts;
+  uint64_t *targets;
+  /* target bits in all the words before each word */
+  int *ranks;
+  /* stack depth on entry to each target, in offset order */
+  int *depths;
+  int target_count;
+  /* targets reached whose code has not been checked yet, each once */
+  int *pending;
+  int pending_count;
+  int max_stack;
+};
+
+static bool fail(struct Verifier *verifier, int offset, const char *message)
+{
+  struct Chunk *chunk = verifier->chunk;
+  fprintf(stderr, "Invalid bytecode at offset %d: %s.\n", offset, message);
+  if (chunk->line_count > 0)
+    fprintf(stderr, "[line %d] in script\n", get_line(chunk, offset));
+  return false;
+}
+
+static bool has_bit(uint64_t *bits, int offset)
+{
+  return (bits[offset >> 6] >> (offset & 63)) & 1;
+}
+
+static void set_bit(uint64_t *bits, int offset)
+{
+  bits[offset >> 6] |= (uint64_t)1 << (offset & 63);
+}
+
+static int *target_depth(struct Verifier *verifier, int offset)
+{
+  uint64_t before = verifier->targets[offset >> 6] & (((uint64_t)1 << (offset & 63)) - 1);
+  return &verifier->depths[verifier->ranks[offset >> 6] + __builtin_popcountll(before)];
+}
+
+/* the big-endian operand of size bytes after the opcode at offset */
+static uint32_t read_operand(struct Chunk *chunk, int offset, int size)
+{
+  uint32_t operand = 0;
+  for (int i = 1; i <= size; i++)
+    operand = (operand << 8) | chunk->code[offset + i];
+  return operand;
+}
+
+static bool is_jmp(uint8_t instruction)
+{
+  switch (instruction)
+  {
+    case OP_JMP:
+    case OP_JNT:
+    case OP_JL:
+    case OP_JMP_LONG:
+    case OP_JNT_LONG:
+    case OP_JL_LONG:
+      return true;
+    default:
+      return false;
+  }
+}
+
+/* where the jump of length bytes at offset goes, -1 if that is outside the chunk */
+static int jmp_target(struct Chunk *chunk, int offset, int length)
+{
+  uint32_t jmp = read_operand(chunk, offset, length - 1);
+  /* a 32-bit distance could wrap the offset around */
+  if (jmp > (uint32_t)chunk->count)
+    return -1;
+  bool backward = chunk->code[offset] == OP_JL || chunk->code[offset] == OP_JL_LONG;
+  int target = offset + length + (backward ? -(int)jmp : (int)jmp);
+  return target >= 0 && target < chunk->count ? target : -1;
+}
+
+/*
+ * marks instructions and jump targets, checking every instruction fits
+ * in the chunk and every jump lands on the start of one. the entry
+ * counts as a target so checking starts from there like from any other.
+ */
+static bool mark_targets(struct Verifier *verifier)
+{
+  struct Chunk *chunk = verifier->chunk;
+  if (chunk->count == 0)
+    return fail(verifier, 0, "empty chunk");
+  set_bit(verifier->targets, 0);
+  for (int offset = 0, length; offset < chunk->count; offset += length)
+  {
+    length = instruction_length(chunk, offset);
+    set_bit(verifier->starts, offset);
+    if (offset + length > chunk->count)
+      return fail(verifier, offset, "instruction cut off by the end of the chunk");
+    if (!is_jmp(chunk->code[offset]))
+      continue;
+    int target = jmp_target(chunk, offset, length);
+    if (target == -1)
+      return fail(verifier, offset, "jump leaves the chunk");
+    set_bit(verifier->targets, target);
+  }
+
+  int rank = 0;
+  for (int word = 0; word < verifier->words; word++)
+  {
+    uint64_t inside = verifier->targets[word] & ~verifier->starts[word];
+    if (inside != 0)
+      return fail(verifier, word * 64 + __builtin_ctzll(inside),
+                  "jump into the middle of an instruction");
+    verifier->ranks[word] = rank;
+    rank += __builtin_popcountll(verifier->targets[word]);
+  }
+  verifier->target_count = rank;
+  return true;
+}
+
+/* records that control reaches target with depth values on the stack */
+static bool reach(struct Verifier *verifier, int target, int depth)
+{
+  int *target_depth_slot = target_depth(verifier, target);
+  if (*target_depth_slot == UNREACHED)
+  {
+    *target_depth_slot = depth;
+    verifier->pending[verifier->pending_count++] = target;
+    return true;
+  }
+  if (*target_depth_slot != depth)
+    return fail(verifier, target, "stack depth differs between paths");
+  return true;
+}
+
+static bool check_constant(struct Verifier *verifier, int offset, uint32_t index, bool name)
+{
+  struct Chunk *chunk = verifier->chunk;
+  if (index >= (uint32_t)chunk->constants.count)
+    return fail(verifier, offset, "constant index out of range");
+  if (name && !IS_STRING(chunk->constants.values[index]))
+    return fail(verifier, offset, "variable name is not a string");
+  return true;
+}
+
+static bool check_local(struct Verifier *verifier, int offset, uint32_t slot, int depth)
+{
+  if (slot >= (uint32_t)depth)
+    return fail(verifier, offset, "local slot out of range");
+  return true;
+}
+
+/*
+ * checks the instruction of length bytes at offset, entered with *depth values on the
+ * stack, and leaves the depth after it there. jumps pass their depth
+ * on to the target, the code after one that does not fall through is
+ * unreachable until some jump lands in it.
+ */
+static bool check_instruction(struct Verifier *verifier, int offset, int length, int *depth)
+{
+  struct Chunk *chunk = verifier->chunk;
+  uint8_t instruction = chunk->code[offset];
+  /* the constant index or local slot, whatever its width */
+  uint32_t operand = read_operand(chunk, offset, length - 1);
+  int pops = 0;
+  int pushes = 0;
+  bool falls_through = true;
+
+  switch (instruction)
+  {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+      if (!check_constant(verifier, offset, operand, false))
+        return false;
+      pushes = 1;
+      break;
+    case OP_GETGLOBAL:
+    case OP_GETGLOBAL_LONG:
+      if (!check_constant(verifier, offset, operand, true))
+        return false;
+      pushes = 1;
+      break;
+    case OP_DEFINEGLOBAL:
+    case OP_DEFINEGLOBAL_LONG:
+      if (!check_constant(verifier, offset, operand, true))
+        return false;
+      pops = 1;
+      break;
+    case OP_SETGLOBAL:
+    case OP_SETGLOBAL_LONG:
+      if (!check_constant(verifier, offset, operand, true))
+        return false;
+      pops = pushes = 1;
+      break;
+    case OP_GETLOCAL:
+    case OP_GETLOCAL_LONG:
+      if (!check_local(verifier, offset, operand, *depth))
+        return false;
+      pushes = 1;
+      break;
+    case OP_SETLOCAL:
+    case OP_SETLOCAL_LONG:
+      if (!check_local(verifier, offset, operand, *depth))
+        return false;
+      pops = pushes = 1;
+      break;
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+      pushes = 1;
+      break;
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_EQUAL:
+    case OP_CHARAT:
+    case OP_FIND:
+    case OP_CONTAINS:
+    case OP_STARTSWITH:
+    case OP_ENDSWITH:
+    case OP_COUNT:
+      pops = 2;
+      pushes = 1;
+      break;
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_LEN:
+      pops = pushes = 1;
+      break;
+    case OP_SUBSTR:
+      pops = 3;
+      pushes = 1;
+      break;
+    case OP_CONCAT:
+      pops = (int)operand;
+      if (pops < 2)
+        return fail(verifier, offset, "concatenation of fewer than two values");
+      pushes = 1;
+      break;
+    case OP_PRINT:
+    case OP_POP:
+      pops = 1;
+      break;
+    case OP_JMP:
+    case OP_JMP_LONG:
+    case OP_JL:
+    case OP_JL_LONG:
+    case OP_RETURN:
+      falls_through = false;
+      break;
+    case OP_JNT:
+    case OP_JNT_LONG:
+      /* the condition is only looked at, the code after pops it */
+      pops = pushes = 1;
+      break;
+    default:
+      return fail(verifier, offset, "unknown opcode");
+  }
+
+  if (*depth < pops)
+    return fail(verifier, offset, "stack underflow");
+  *depth += pushes - pops;
+  if (*depth > verifier->max_stack)
+    verifier->max_stack = *depth;
+
+  if (is_jmp(instruction) && !reach(verifier, jmp_target(chunk, offset, length), *depth))
+    return false;
+  if (!falls_through)
+    *depth = UNREACHED;
+  return true;
+}
+
+/*
+ * checks the straight run of code from the target at offset up to an
+ * instruction that does not fall through or the next target. the depth
+ * carries from one instruction to the next, only targets have paths in
+ * from elsewhere that need to agree with it.
+ */
+static bool check_block(struct Verifier *verifier, int offset)
+{
+  struct Chunk *chunk = verifier->chunk;
+  int depth = *target_depth(verifier, offset);
+  for (;;)
+  {
+    int next = offset + instruction_length(chunk, offset);
+    if (!check_instruction(verifier, offset, next - offset, &depth))
+      return false;
+    if (depth == UNREACHED)
+      return true;
+    if (next == chunk->count)
+      return fail(verifier, offset, "code runs off the end of the chunk");
+    if (has_bit(verifier->targets, next))
+      return reach(verifier, next, depth);
+    offset = next;
+  }
+}
+
+/*
+ * every run of code is checked once, when a path first reaches the
+ * target it starts at, so the work is linear in the size of the chunk.
+ * code no path reaches is never looked at past its length.
+ */
+bool verify_chunk(struct Chunk *chunk)
+{
+  struct Verifier verifier;
+  verifier.chunk = chunk;
+  verifier.words = (chunk->count + 63) / 64;
+  verifier.starts = (uint64_t *)reallocate(NULL, 0, sizeof(uint64_t) * verifier.words);
+  verifier.targets = (uint64_t *)reallocate(NULL, 0, sizeof(uint64_t) * verifier.words);
+  verifier.ranks = (int *)reallocate(NULL, 0, sizeof(int) * verifier.words);
+  memset(verifier.starts, 0, sizeof(uint64_t) * verifier.words);
+  memset(verifier.targets, 0, sizeof(uint64_t) * verifier.words);
+  verifier.depths = NULL;
+  verifier.target_count = 0;
+  verifier.pending = NULL;
+  verifier.pending_count = 0;
+  verifier.max_stack = 0;
+
+  bool ok = mark_targets(&verifier);
+  if (ok)
+  {
+    verifier.depths = (int *)reallocate(NULL, 0, sizeof(int) * verifier.target_count);
+    verifier.pending = (int *)reallocate(NULL, 0, sizeof(int) * verifier.target_count);
+    for (int i = 0; i < verifier.target_count; i++)
+      verifier.depths[i] = UNREACHED;
+    ok = reach(&verifier, 0, 0);
+  }
+  while (ok && verifier.pending_count > 0)
+    ok = check_block(&verifier, verifier.pending[--verifier.pending_count]);
+
+  reallocate(verifier.starts, sizeof(uint64_t) * verifier.words, 0);
+  reallocate(verifier.targets, sizeof(uint64_t) * verifier.words, 0);
+  reallocate(verifier.ranks, sizeof(int) * verifier.words, 0);
+  reallocate(verifier.depths, sizeof(int) * verifier.target_count, 0);
+  reallocate(verifier.pending, sizeof(int) * verifier.target_count, 0);
+  if (ok)
+    chunk->max_stack = verifier.max_stack;
+  return ok;
+}
@@ -0,0 +1,16 @@
+#ifndef VERIFY_H_
+#define VERIFY_H_
+
+#include "chunk.h"
+
+/*
+ * checks that chunk is safe to run without any checks in the vm: every
+ * jump lands on an instruction inside the chunk, constant and local
+ * operands are in range, the stack never underflows and has the same
+ * depth on every path into an instruction, and no path runs off the
+ * end. on success chunk->max_stack is set to the deepest the stack
+ * gets, otherwise the first problem is reported on stderr.
+ */
+bool verify_chunk(struct Chunk *chunk);
+
+#endif
@@ -1,36 +1,37 @@
 #include "common.h"
 #include "compiler.h"
-#include "disassem.h"
+#include "hash.h"
 #include "vm.h"
 #include "memory.h"
+#include "strsearch.h"
 #include "object.h"
 #include "value.h"
+#include "verify.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
 
-struct VM vm;
-
-static void reset_stack()
+static void reset_stack(struct VM *vm)
 {
-  vm.stack_top = vm.stack;
+  vm->stack_top = vm->stack.slots;
 }
 
-void push(Value value)
+void push(struct VM *vm, Value value)
 {
-  *vm.stack_top = value;
-  vm.stack_top++;
+  *vm->stack_top = value;
+  vm->stack_top++;
 }
 
-Value pop()
+Value pop(struct VM *vm)
 {
-  vm.stack_top--;
-  return *vm.stack_top;
+  vm->stack_top--;
+  return *vm->stack_top;
 }
 
-static Value peek(int distance)
+static Value peek(struct VM *vm, int distance)
 {
-  return vm.stack_top[-1 - distance];
+  return vm->stack_top[-1 - distance];
 }
 
 /*
@@ -42,171 +43,457 @@ static bool is_falsey(Value value)
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate()
+/*
+ * short results are built and interned right away, longer ones become
+ * ropes so building a string piece by piece does not copy and hash the
+ * whole thing on every step
+ */
+static Value join_text(struct VM *vm, struct Obj *a, struct Obj *b)
 {
-  struct ObjString *b = AS_STRING(pop());
-  struct ObjString *a = AS_STRING(pop());
+  int length = text_length(a) + text_length(b);
+  if (length >= ROPE_MIN_LENGTH)
+    return OBJ_VAL(new_rope(vm, a, b));
 
-  int length = a->length + b->length;
+  /* ropes are never this short so both sides are flat strings */
+  struct ObjString *str_a = (struct ObjString *)a;
+  struct ObjString *str_b = (struct ObjString *)b;
   char *str = (char *)reallocate(NULL, 0, length + 1);
-  memcpy(str, a->c_str, a->length);
-  memcpy(str + a->length, b->c_str, b->length);
+  memcpy(str, str_a->chars, str_a->length);
+  memcpy(str + str_a->length, str_b->chars, str_b->length);
   str[length] = '\0'; 
   
-  struct ObjString *res = take_str(str, length);
-  push(OBJ_VAL(res));
+  return OBJ_VAL(take_str(vm, str, length));
 }
 
+static void concatenate(struct VM *vm)
+{
+  struct Obj *b = AS_OBJ(pop(vm));
+  struct Obj *a = AS_OBJ(pop(vm));
+  push(vm, join_text(vm, a, b));
+}
 
+/* the characters of a string operand, ropes are flattened first */
+static struct ObjString *text_operand(struct VM *vm, Value value)
+{
+  if (IS_ROPE(value))
+    return flatten_rope(vm, AS_ROPE(value));
+  return AS_STRING(value);
+}
 
+/* truncates an index and clamps it into [0, length] */
+static int clamp_index(double index, int length)
+{
+  if (!(index > 0))
+    return 0;
+  if (index > length)
+    return length;
+  return (int)index;
+}
 
+/*
+ * two strings of the same length. interned strings are equal only if
+ * they are the same object, so a match between two of them never looks
+ * at the characters. the hash is no use beyond that: only interned
+ * strings have one, strings built at runtime, slices and flattened
+ * ropes are never hashed, and hashing one here would read every byte
+ * the compare may stop well short of.
+ */
+static bool same_text(struct ObjString *a, struct ObjString *b)
+{
+  if (a == b)
+    return true;
+  if (a->interned && b->interned)
+    return false;
+  return str_mismatch(a->chars, b->chars, a->length) == a->length;
+}
 
-void init_vm()
+/* whether needle occurs in text at offset */
+static bool matches_at(struct ObjString *text, int offset, struct ObjString *needle)
 {
-  reset_stack();
-  vm.head_obj = NULL;
-  init_table(&vm.globals);
-  init_table(&vm.strings);
+  if (offset < 0)
+    return false;
+  if (needle->length == text->length)
+    return same_text(text, needle);
+  return str_mismatch(text->chars + offset, needle->chars, needle->length) == needle->length;
 }
 
-void free_vm()
+static Value search_text(uint8_t instruction, struct ObjString *text, struct ObjString *needle)
 {
-  free_table(&vm.globals);
-  free_table(&vm.strings);
-  free_objs();
+  /*
+   * lengths settle the search before any kernel runs: a longer needle
+   * never occurs, and one as long only where the two are equal
+   */
+  if (needle->length > text->length ||
+      (needle->length == text->length && needle->length > 0 && !same_text(text, needle)))
+  {
+    if (instruction == OP_FIND)
+      return NUMBER_VAL(-1);
+    if (instruction == OP_COUNT)
+      return NUMBER_VAL(0);
+    return BOOL_VAL(false);
+  }
+
+  switch (instruction)
+  {
+    case OP_FIND:
+      return NUMBER_VAL(str_find(text->chars, text->length, needle->chars, needle->length));
+    case OP_CONTAINS:
+      return BOOL_VAL(str_find(text->chars, text->length, needle->chars, needle->length) >= 0);
+    case OP_STARTSWITH:
+      return BOOL_VAL(needle->length <= text->length && matches_at(text, 0, needle));
+    case OP_ENDSWITH:
+      return BOOL_VAL(matches_at(text, text->length - needle->length, needle));
+    default:
+      return NUMBER_VAL(str_count(text->chars, text->length, needle->chars, needle->length));
+  }
+}
+
+/* pops two strings and orders them bytewise, <0, 0 or >0 */
+static int compare_text(struct VM *vm)
+{
+  struct ObjString *b = text_operand(vm, pop(vm));
+  struct ObjString *a = text_operand(vm, pop(vm));
+  if (a == b)
+    return 0;
+  return str_compare(a->chars, a->length, b->chars, b->length);
+}
+
+/* ropes are flattened before anything looks at their characters */
+static Value flat_value(struct VM *vm, Value value)
+{
+  if (IS_ROPE(value))
+    return OBJ_VAL(flatten_rope(vm, AS_ROPE(value)));
+  return value;
 }
 
-static void runtime_err(const char* format, ...)
+void init_vm(struct VM *vm)
 {
+  init_hash_seed();
+  init_stack(&vm->stack);
+  reset_stack(vm);
+  vm->head_obj = NULL;
+  init_table(&vm->globals);
+  init_table(&vm->strings);
+  init_output(&vm->out, STDOUT_FILENO);
+  vm->trace = NULL;
+  vm->profile = NULL;
+  vm->instrumented = false;
+  vm->sampler = NULL;
+}
+
+void free_vm(struct VM *vm)
+{
+  free_table(&vm->globals);
+  free_table(&vm->strings);
+  free_objs(vm);
+  free_output(&vm->out);
+  free_stack(&vm->stack);
+}
+
+static void runtime_err(struct VM *vm, const char* format, ...)
+{
+  /* everything printed before the error shows up before it */
+  flush_output(&vm->out);
   va_list args;
   va_start(args, format);
   vfprintf(stderr, format, args);
   va_end(args);
   fputs("\n", stderr);
 
-  size_t instruction = vm.ip - vm.chunk->code - 1;
-  int line = vm.chunk->lines[instruction];
+  size_t instruction = vm->ip - vm->chunk->code - 1;
+  int line = get_line(vm->chunk, (int)instruction);
   fprintf(stderr, "[line %d] in script\n", line);
-  reset_stack();
+  reset_stack(vm);
 }
 
 
 
-static enum InterpretResult run()
+/*
+ * joins the top count values for OP_CONCAT. when they are all strings
+ * the result is sized once and every piece copied straight into it, a
+ * long string on the left (s = s + a + b) becomes a rope with the rest
+ * appended as one piece. anything else is folded pairwise exactly like a chain
+ * of OP_ADDs would have.
+ */
+static bool concatenate_n(struct VM *vm, int count)
+{
+  Value *args = vm->stack_top - count;
+  bool all_text = true;
+  for (int i = 0; i < count && all_text; i++)
+    all_text = IS_TEXT(args[i]);
+
+  if (!all_text)
+  {
+    Value acc = args[0];
+    for (int i = 1; i < count; i++)
+    {
+      if (IS_NUMBER(acc) && IS_NUMBER(args[i]))
+        acc = NUMBER_VAL(AS_NUMBER(acc) + AS_NUMBER(args[i]));
+      /* nothing is pushed, the verifier sized the stack for the operands only */
+      else if (IS_TEXT(acc) && IS_TEXT(args[i]))
+        acc = join_text(vm, AS_OBJ(acc), AS_OBJ(args[i]));
+      else
+      {
+        runtime_err(vm, "Operands must be numbers or strings.");
+        return false;
+      }
+    }
+    vm->stack_top = args;
+    push(vm, acc);
+    return true;
+  }
+
+  struct Obj *first = AS_OBJ(args[0]);
+  bool keep_rope = text_length(first) >= ROPE_MIN_LENGTH;
+  int start = keep_rope ? 1 : 0;
+  int length = 0;
+  for (int i = start; i < count; i++)
+    length += text_length(AS_OBJ(args[i]));
+
+  char *str = (char *)reallocate(NULL, 0, length + 1);
+  char *dest = str;
+  for (int i = start; i < count; i++)
+  {
+    copy_text(AS_OBJ(args[i]), dest);
+    dest += text_length(AS_OBJ(args[i]));
+  }
+  str[length] = '\0';
+
+  Value res = OBJ_VAL(take_str(vm, str, length));
+  if (keep_rope)
+    res = OBJ_VAL(new_rope(vm, first, AS_OBJ(res)));
+  vm->stack_top = args;
+  push(vm, res);
+  return true;
+}
+
+/* out of line so the dispatch loop is laid out as if instrumentation did not exist */
+__attribute__((noinline, cold)) static void instrument_step(struct VM *vm)
+{
+  int offset = (int)(vm->ip - vm->chunk->code);
+  if (vm->trace != NULL)
+    trace_instruction(vm->trace, (uint32_t)offset, *vm->ip,
+                      (uint32_t)(vm->stack_top - vm->stack.slots));
+  if (vm->profile != NULL)
+    profile_instruction(vm->profile, offset, *vm->ip);
+}
+
+/*
+ * kept out of execute(), a function that calls sigsetjmp is compiled
+ * without keeping values in registers across calls and the dispatch
+ * loop would pay for that on every instruction
+ */
+__attribute__((noinline)) static enum InterpretResult run(struct VM *vm)
 {
+  /* kept in a register, vm->ip is only written once per instruction */
+  uint8_t *ip = vm->ip;
   for (;;)
   {
-#define READ_BYTE() *(vm.ip++)
-#define READ_CONSTANT() vm.chunk->constants.values[READ_BYTE()]
+#define READ_BYTE() *(ip++)
+#define READ_CONSTANT() vm->chunk->constants.values[READ_BYTE()]
 /* takes the next 2 bytes from the chunk and builds a 16-bit uint out of them */
-#define READ_SHORT() (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1]))
+#define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+/* the 3 byte big endian operand of the long opcodes */
+#define READ_LONG() (ip += 3, (uint32_t)((ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+#define READ_LONG_CONSTANT() vm->chunk->constants.values[READ_LONG()]
+/* the 4 byte big endian offset of the long jumps */
+#define READ_WORD() \
+    (ip += 4, ((uint32_t)ip[-4] << 24) | ((uint32_t)ip[-3] << 16) | \
+                  ((uint32_t)ip[-2] << 8) | (uint32_t)ip[-1])
+/* a global's name, from a short or long index */
+#define READ_NAME(long_op) \
+    AS_STRING(instruction == (long_op) ? READ_LONG_CONSTANT() : READ_CONSTANT())
 #define BINARY_OP(value_type, op) \
     do \
     { \
-      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) \
+      if (!IS_NUMBER(peek(vm, 0)) || !IS_NUMBER(peek(vm, 1))) \
       { \
-        runtime_err("Operands must be numbers."); \
+        runtime_err(vm, "Operands must be numbers."); \
         return INTERPRET_RUNTIME_ERR; \
       } \
-      double b = AS_NUMBER(pop()); \
-      double a = AS_NUMBER(pop()); \
-      push(value_type(a op b)); \
+      double b = AS_NUMBER(pop(vm)); \
+      double a = AS_NUMBER(pop(vm)); \
+      push(vm, value_type(a op b)); \
     } while (false)
-#ifdef DEBUG_TRACE_EXECUTION
-    disassem_instruction(vm.chunk,
-             (int)(vm.ip - vm.chunk->code));
-
-    printf(" CURRENT STACK: [");
-    for (Value *slot = vm.stack; slot < vm.stack_top; slot++)
+/* numbers are checked first so string support costs them nothing */
+#define COMPARE_OP(op) \
+    do \
+    { \
+      if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1))) \
+      { \
+        double b = AS_NUMBER(pop(vm)); \
+        double a = AS_NUMBER(pop(vm)); \
+        push(vm, BOOL_VAL(a op b)); \
+      } \
+      else if (IS_TEXT(peek(vm, 0)) && IS_TEXT(peek(vm, 1))) \
+        push(vm, BOOL_VAL(compare_text(vm) op 0)); \
+      else \
+      { \
+        runtime_err(vm, "Operands must be two numbers or two strings."); \
+        return INTERPRET_RUNTIME_ERR; \
+      } \
+    } while (false)
+    /* all tracing and profiling cost when they are off */
+    if (__builtin_expect(vm->instrumented, 0))
     {
-      print_value(*slot, false);
-      if (slot != vm.stack_top - 1)
-        printf(", ");
+      vm->ip = ip;
+      instrument_step(vm);
     }
-    printf("]\n");
-
-#endif
-    uint8_t instruction;
-    switch (instruction = READ_BYTE())
+    uint8_t instruction = READ_BYTE();
+    /*
+     * vm->ip is published past the opcode for runtime errors and for the
+     * sampling profiler, which reads it from a signal handler. the atomic store
+     * makes sure it is in memory at every dispatch
+     */
+    __atomic_store_n(&vm->ip, ip, __ATOMIC_RELAXED);
+    switch (instruction)
     {
       case OP_CONSTANT:
       {
         Value constant = READ_CONSTANT();
-        push(constant);
+        push(vm, constant);
         break;
       }
-      case OP_NIL:   push(NIL_VAL);         break;
-      case OP_TRUE:  push(BOOL_VAL(true));  break;
-      case OP_FALSE: push(BOOL_VAL(false)); break;
+      case OP_CONSTANT_LONG:
+        push(vm, READ_LONG_CONSTANT());
+        break;
+      case OP_NIL:   push(vm, NIL_VAL);         break;
+      case OP_TRUE:  push(vm, BOOL_VAL(true));  break;
+      case OP_FALSE: push(vm, BOOL_VAL(false)); break;
       case OP_EQUAL:
       {
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(values_equal(a, b)));
+        Value b = flat_value(vm, pop(vm));
+        Value a = flat_value(vm, pop(vm));
+        push(vm, BOOL_VAL(values_equal(a, b)));
         break;
       }
-      case OP_POP: pop(); break;
+      case OP_POP: pop(vm); break;
       case OP_NEGATE:
-        if (!IS_NUMBER(peek(0)))
+        if (!IS_NUMBER(peek(vm, 0)))
         {
-          runtime_err("Operand must be a number.");
+          runtime_err(vm, "Operand must be a number.");
           return INTERPRET_RUNTIME_ERR;
         }
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
+        push(vm, NUMBER_VAL(-AS_NUMBER(pop(vm))));
         break;
-      case OP_GREATER:  BINARY_OP(BOOL_VAL, >);   break;
-      case OP_LESS:     BINARY_OP(BOOL_VAL, <);   break;
+      case OP_GREATER:  COMPARE_OP(>);            break;
+      case OP_LESS:     COMPARE_OP(<);            break;
       case OP_ADD:
       {
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
-          concatenate(); 
-        else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+        if (IS_TEXT(peek(vm, 0)) && IS_TEXT(peek(vm, 1)))
+          concatenate(vm); 
+        else if (IS_NUMBER(peek(vm, 0)) && IS_NUMBER(peek(vm, 1)))
         {
-          double b = AS_NUMBER(pop());
-          double a = AS_NUMBER(pop());
-          push(NUMBER_VAL(a + b));
+          double b = AS_NUMBER(pop(vm));
+          double a = AS_NUMBER(pop(vm));
+          push(vm, NUMBER_VAL(a + b));
         }
         else
         {
-          runtime_err("Operands must be numbers or strings.");
+          runtime_err(vm, "Operands must be numbers or strings.");
+          return INTERPRET_RUNTIME_ERR;
+        }
+        break;
+      }
+      case OP_CONCAT:
+      {
+        uint8_t count = READ_BYTE();
+        if (!concatenate_n(vm, count))
+          return INTERPRET_RUNTIME_ERR;
+        break;
+      }
+      case OP_LEN:
+      {
+        if (!IS_TEXT(peek(vm, 0)))
+        {
+          runtime_err(vm, "Operand must be a string.");
           return INTERPRET_RUNTIME_ERR;
         }
+        push(vm, NUMBER_VAL(text_length(AS_OBJ(pop(vm)))));
+        break;
+      }
+      case OP_SUBSTR:
+      {
+        if (!IS_TEXT(peek(vm, 2)) || !IS_NUMBER(peek(vm, 1)) || !IS_NUMBER(peek(vm, 0)))
+        {
+          runtime_err(vm, "Operands must be a string, a start and a length.");
+          return INTERPRET_RUNTIME_ERR;
+        }
+        double length = AS_NUMBER(pop(vm));
+        double start = AS_NUMBER(pop(vm));
+        struct ObjString *str = text_operand(vm, pop(vm));
+        int from = clamp_index(start, str->length);
+        int count = clamp_index(length, str->length - from);
+        push(vm, OBJ_VAL(slice_str(vm, str, from, count)));
+        break;
+      }
+      case OP_CHARAT:
+      {
+        if (!IS_TEXT(peek(vm, 1)) || !IS_NUMBER(peek(vm, 0)))
+        {
+          runtime_err(vm, "Operands must be a string and an index.");
+          return INTERPRET_RUNTIME_ERR;
+        }
+        double index = AS_NUMBER(pop(vm));
+        struct ObjString *str = text_operand(vm, pop(vm));
+        /* out of range gives an empty string */
+        bool in_range = index >= 0 && index < str->length;
+        push(vm, OBJ_VAL(slice_str(vm, str, in_range ? (int)index : 0, in_range ? 1 : 0)));
+        break;
+      }
+      case OP_FIND:
+      case OP_CONTAINS:
+      case OP_STARTSWITH:
+      case OP_ENDSWITH:
+      case OP_COUNT:
+      {
+        if (!IS_TEXT(peek(vm, 0)) || !IS_TEXT(peek(vm, 1)))
+        {
+          runtime_err(vm, "Operands must be strings.");
+          return INTERPRET_RUNTIME_ERR;
+        }
+        struct ObjString *needle = text_operand(vm, pop(vm));
+        struct ObjString *text = text_operand(vm, pop(vm));
+        push(vm, search_text(instruction, text, needle));
         break;
       }
       case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
       case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
       case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
       case OP_NOT:
-        push(BOOL_VAL(is_falsey(pop())));
+        push(vm, BOOL_VAL(is_falsey(pop(vm))));
         break;
       case OP_GETGLOBAL:
+      case OP_GETGLOBAL_LONG:
       {
         /* Read operand which is an index to a string in the string table */
-        struct ObjString *name = READ_STRING();
+        struct ObjString *name = READ_NAME(OP_GETGLOBAL_LONG);
         Value value;
-        if (!table_get(&vm.globals, name, &value))
+        if (!table_get(&vm->globals, name, &value))
         {
-          runtime_err("Undefined variable '%s'.", name->c_str);
+          runtime_err(vm, "Undefined variable '%.*s'.", name->length, name->chars);
           return INTERPRET_RUNTIME_ERR;
         }
-        push(value);
+        push(vm, value);
         break;
       }
       case OP_DEFINEGLOBAL:
+      case OP_DEFINEGLOBAL_LONG:
       {
-        struct ObjString *name = READ_STRING();
-        table_set(&vm.globals, name, peek(0));
-        pop();
+        struct ObjString *name = READ_NAME(OP_DEFINEGLOBAL_LONG);
+        table_set(&vm->globals, name, peek(vm, 0));
+        pop(vm);
         break;
       }
       case OP_SETGLOBAL:
+      case OP_SETGLOBAL_LONG:
       {
-        struct ObjString *name = READ_STRING();
-        if (table_set(&vm.globals, name, peek(0)))
+        struct ObjString *name = READ_NAME(OP_SETGLOBAL_LONG);
+        if (table_set(&vm->globals, name, peek(vm, 0)))
         {
-          table_delete(&vm.globals, name);
-          runtime_err("Undefined variable '%s'.", name->c_str);
+          table_delete(&vm->globals, name);
+          runtime_err(vm, "Undefined variable '%.*s'.", name->length, name->chars);
           return INTERPRET_RUNTIME_ERR;
         }
         break;
@@ -214,38 +501,69 @@ static enum InterpretResult run()
       case OP_GETLOCAL:
       {
         uint8_t slot = READ_BYTE();
-        push(vm.stack[slot]);
+        push(vm, vm->stack.slots[slot]);
+        break;
+      }
+      case OP_GETLOCAL_LONG:
+      {
+        int slot = READ_LONG();
+        push(vm, vm->stack.slots[slot]);
         break;
       }
       case OP_SETLOCAL:
       {
         uint8_t slot = READ_BYTE();
-        vm.stack[slot] = peek(0);
+        vm->stack.slots[slot] = peek(vm, 0);
+        break;
+      }
+      case OP_SETLOCAL_LONG:
+      {
+        int slot = READ_LONG();
+        vm->stack.slots[slot] = peek(vm, 0);
         break;
       }
       case OP_PRINT:
       {
-        print_value(pop(), false);
-        printf("\n");
+        write_value(&vm->out, flat_value(vm, pop(vm)));
+        end_line(&vm->out);
         break;
       }
       case OP_JMP:
       {
         uint16_t offset = READ_SHORT();
-        vm.ip += offset;
+        ip += offset;
         break;
       }
       case OP_JNT:
       {
         uint16_t offset = READ_SHORT();
-        if (is_falsey(peek(0)))
-          vm.ip += offset;
+        if (is_falsey(peek(vm, 0)))
+          ip += offset;
         break;
       }
       case OP_JL:
       {
         uint16_t offset = READ_SHORT();
-        vm.ip -= offset;
+        ip -= offset;
+        break;
+      }
+      case OP_JMP_LONG:
+      {
+        uint32_t offset = READ_WORD();
+        ip += offset;
+        break;
+      }
+      case OP_JNT_LONG:
+      {
+        uint32_t offset = READ_WORD();
+        if (is_falsey(peek(vm, 0)))
+          ip += offset;
+        break;
+      }
+      case OP_JL_LONG:
+      {
+        uint32_t offset = READ_WORD();
+        ip -= offset;
         break;
       }
       case OP_RETURN:
@@ -253,39 +571,80 @@ static enum InterpretResult run()
     }
 
 #undef BINARY_OP 
+#undef COMPARE_OP
 #undef READ_BYTE
 #undef READ_SHORT
 #undef READ_CONSTANT
 #undef READ_STRING
+#undef READ_LONG
+#undef READ_LONG_CONSTANT
+#undef READ_WORD
+#undef READ_NAME
   }
 }
 
 
-enum InterpretResult interpret(const char *src)
+/*
+ * chunks from the compiler are verified already, anything else is
+ * checked here before it runs. the stack is then grown to what the
+ * chunk needs so run() never has to look at its bounds, a chunk deeper
+ * than the whole reservation runs until it pushes into the guard page.
+ */
+enum InterpretResult execute(struct VM *vm, struct Chunk *chunk)
+{
+  if (chunk->max_stack < 0 && !verify_chunk(chunk))
+    return INTERPRET_COMPILE_ERR;
+  bool fits = grow_stack(&vm->stack, (size_t)chunk->max_stack);
+  vm->chunk = chunk;
+  vm->ip = vm->chunk->code;
+  reset_stack(vm);
+  /* without the fault handler nothing catches the push into the guard page */
+  if (!fits && !stacks_guarded())
+  {
+    /* reported against the first instruction, which is as close as we know */
+    vm->ip++;
+    runtime_err(vm, "Stack overflow.");
+    return INTERPRET_RUNTIME_ERR;
+  }
+  vm->instrumented = vm->trace != NULL || vm->profile != NULL;
+  if (vm->profile != NULL)
+    start_profile(vm->profile, chunk);
+  if (vm->sampler != NULL)
+    begin_samples(vm->sampler, vm, chunk);
+
+  enum InterpretResult result;
+  if (sigsetjmp(vm->stack.overflow, 0) == 0)
+  {
+    watch_stack(&vm->stack);
+    result = run(vm);
+  }
+  else
+  {
+    runtime_err(vm, "Stack overflow.");
+    result = INTERPRET_RUNTIME_ERR;
+  }
+  watch_stack(NULL);
+  if (vm->profile != NULL)
+    finish_profile(vm->profile);
+  if (vm->sampler != NULL)
+    end_samples(vm->sampler);
+  flush_output(&vm->out);
+  return result;
+}
+
+enum InterpretResult interpret(struct VM *vm, const char *src, size_t length)
 {
   struct Chunk chunk;
   init_chunk(&chunk);
 
-  if (!compile(src, &chunk))
+  if (!compile(vm, src, length, &chunk))
   {
     free_chunk(&chunk);
     return INTERPRET_COMPILE_ERR;
   }
 
-  vm.chunk = &chunk;
-  vm.ip = vm.chunk->code;
-
-  enum InterpretResult result = run();
+  enum InterpretResult result = execute(vm, &chunk);
 
   free_chunk(&chunk);
-  return INTERPRET_OK;
+  return result;
 }
-
-//enum InterpretResult interpret(struct Chunk *chunk)
-//{
-//  vm.chunk = chunk;
-//  vm.ip = vm.chunk->code;
-//  return run();
-//}
-
-
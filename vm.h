@@ -4,18 +4,30 @@
 #include "chunk.h"
 #include "table.h"
 #include "object.h"
-
-#define STACK_MAX 256
+#include "output.h"
+#include "stack.h"
+#include "trace.h"
+#include "profile.h"
+#include "sample.h"
 
 struct VM 
 {
   struct Chunk* chunk;
   uint8_t *ip;
-  Value stack[STACK_MAX];
+  /* pushes are never checked, the guard page past it catches overflow */
+  struct Stack stack;
   Value *stack_top;
   struct Obj *head_obj;
   struct Table globals;
   struct Table strings;
+  struct Output out;
+  /* instrumentation, off while both are NULL as they are by default */
+  struct Trace *trace;
+  struct Profile *profile;
+  /* either of them is set, checked once per instruction */
+  bool instrumented;
+  /* samples this vm's runs when set, costs nothing per instruction */
+  struct Sampler *sampler;
 };
 
 enum InterpretResult
@@ -25,13 +37,12 @@ enum InterpretResult
   INTERPRET_RUNTIME_ERR,
 };
 
-extern struct VM vm;
-
-void init_vm();
-// enum InterpretResult interpret(struct Chunk *chunk);
-enum InterpretResult interpret(const char *src);
-void push(Value value);
-Value pop();
-void free_vm();
+void init_vm(struct VM *vm);
+/* src is length bytes followed by a nul */
+enum InterpretResult interpret(struct VM *vm, const char *src, size_t length);
+enum InterpretResult execute(struct VM *vm, struct Chunk *chunk);
+void push(struct VM *vm, Value value);
+Value pop(struct VM *vm);
+void free_vm(struct VM *vm);
 
 #endif